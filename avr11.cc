@@ -1,76 +1,209 @@
 #include <assert.h>
 #include <cstdlib>
-#include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <unistd.h>
 
-#include "avr11.h"
-#include "kb11.h"
+#include "clone.h"
+#include "host.h"
+#include "machine.h"
+#include "script.h"
 
-KB11 cpu;
+static Machine machine;
 
-void setup(char *disk) {
-    struct termios old_terminal_settings, new_terminal_settings;
+// instructions per clock tick when running in virtual time, 50Hz at 1 MIPS.
+const uint32_t virtualperiod = 20000;
 
-    // Get the current terminal settings
-    if (tcgetattr(0, &old_terminal_settings) < 0)
-        perror("tcgetattr()");
+// setup connects the machine to the process, and with terminal set the
+// console to the terminal, then attaches the disks and boots from the
+// first, or with restore set resumes the machine saved there.
+void setup(char **disks, int n, const char *restore, bool realtime,
+           bool terminal) {
+    hostattach(machine, realtime);
 
-    memcpy(&new_terminal_settings, &old_terminal_settings,
-           sizeof(struct termios));
+    if (terminal) {
+        struct termios old_terminal_settings, new_terminal_settings;
 
-    // disable canonical mode processing in the line discipline driver
-    new_terminal_settings.c_iflag &= ~ICRNL;
-    new_terminal_settings.c_lflag &= ~ICANON;
-    new_terminal_settings.c_lflag &= ~ECHO;
+        // Get the current terminal settings
+        if (tcgetattr(0, &old_terminal_settings) < 0)
+            perror("tcgetattr()");
 
-    // apply our new settings
-    if (tcsetattr(0, TCSANOW, &new_terminal_settings) < 0)
-        perror("tcsetattr ICANON");
-    cpu.unibus.rk11.rkdata = fopen(disk, "rb+");
-    cpu.reset();
-    printf("Ready\n");
-}
-
-jmp_buf trapbuf;
+        memcpy(&new_terminal_settings, &old_terminal_settings,
+               sizeof(struct termios));
 
-void loop0();
+        // disable canonical mode processing in the line discipline driver
+        new_terminal_settings.c_iflag &= ~ICRNL;
+        new_terminal_settings.c_lflag &= ~ICANON;
+        new_terminal_settings.c_lflag &= ~ECHO;
 
-[[noreturn]] void trap(uint16_t vec) { longjmp(trapbuf, vec); }
-
-void loop() {
-    auto vec = setjmp(trapbuf);
-    if (vec == 0) {
-        loop0();
-    } else {
-        cpu.trapat(vec);
+        // apply our new settings
+        if (tcsetattr(0, TCSANOW, &new_terminal_settings) < 0)
+            perror("tcsetattr ICANON");
+    }
+    if (restore) {
+        if (!restoresnapshot(machine.cpu, restore)) {
+            exit(1);
+        }
+        printf("Restored\n");
+        return;
     }
+    for (int i = 0; i < n; i++) {
+        if (!machine.cpu.unibus.rk11.attach(i, disks[i])) {
+            exit(1);
+        }
+    }
+    machine.cpu.reset();
+    printf("Ready\n");
 }
 
-void loop0() {
-    while (true) {
-        cpu.step();
-        if ((cpu.itab[0].vec > 0) && (cpu.itab[0].pri >= cpu.priority())) {
-            cpu.trapat(cpu.itab[0].vec);
-            cpu.popirq();
-            return; // exit from loop to reset trapbuf
-        }
-        cpu.unibus.rk11.step();
-        cpu.unibus.cons.poll();
+// rpunits counts the RP drives attached.
+static uint8_t rpunits = 0;
+
+// attachrp attaches the pack image named by arg, optionally prefixed by
+// rp04: or rp06:, as the next RP drive.
+bool attachrp(const char *arg) {
+    if (rpunits == 8) {
+        fprintf(stderr, "too many RP drives\n");
+        return false;
+    }
+    bool rp04 = false;
+    if (!strncmp(arg, "rp04:", 5)) {
+        rp04 = true;
+        arg += 5;
+    } else if (!strncmp(arg, "rp06:", 5)) {
+        arg += 5;
     }
+    return machine.cpu.unibus.rh11.attach(rpunits++, arg, rp04);
 }
 
-int main(int argc, char *argv[]) {
-    assert(argc > 1);
-    setup(argv[1]);
-    while (1)
-        loop();
+int usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-dtv] [-a cylinders] [-l latency] "
+            "[-r [rp04:|rp06:]pack]...\n"
+            "       [-s exit|write|periodic] [-S snapshot] "
+            "[-e script | clone options] disk...\n"
+            "       %s [-dtv] [-a cylinders] [-l latency] "
+            "[-s exit|write|periodic]\n"
+            "       [-S snapshot] [-e script | clone options] -R snapshot\n"
+            "clone options: -c clones [-j jobs] [-o prefix] [-b pc] "
+            "[-p prompt]\n",
+            name, name);
+    return 1;
 }
 
-void panic() {
-    cpu.printstate();
+int main(int argc, char *argv[]) {
+    int opt;
+    syncpolicy policy = SYNCEXIT;
+    uint32_t readahead = 1;
+    const char *restore = nullptr;
+    const char *script = nullptr;
+    bool realtime = true;
+    while ((opt = getopt(argc, argv, "a:b:c:de:j:l:o:p:r:R:s:S:tv")) != -1) {
+        switch (opt) {
+        case 'a':
+            readahead = strtoul(optarg, nullptr, 0);
+            break;
+        case 'b':
+            machine.breakpoint = strtoul(optarg, nullptr, 8) & 0177777;
+            break;
+        case 'c':
+            clones = strtoul(optarg, nullptr, 0);
+            break;
+        case 'd':
+            machine.cpu.unibus.rk11.model = true;
+            break;
+        case 'e':
+            script = optarg;
+            break;
+        case 'j':
+            clonejobs = strtoul(optarg, nullptr, 0);
+            break;
+        case 'l':
+            machine.cpu.unibus.cons.latency = strtoul(optarg, nullptr, 0);
+            break;
+        case 'o':
+            cloneprefix = optarg;
+            break;
+        case 'p':
+            cloneprompt = *optarg ? optarg : nullptr;
+            break;
+        case 'r':
+            if (!attachrp(optarg)) {
+                return 1;
+            }
+            break;
+        case 'R':
+            restore = optarg;
+            break;
+        case 'S':
+            snapshotfile = optarg;
+            break;
+        case 's':
+            if (!strcmp(optarg, "exit")) {
+                policy = SYNCEXIT;
+            } else if (!strcmp(optarg, "write")) {
+                policy = SYNCWRITE;
+            } else if (!strcmp(optarg, "periodic")) {
+                policy = SYNCPERIODIC;
+            } else {
+                fprintf(stderr, "%s: unknown sync policy %s\n", argv[0],
+                        optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            machine.translate = true;
+            break;
+        case 'v':
+            machine.cpu.unibus.kw11.virtualclock(virtualperiod);
+            realtime = false;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    // a pool needs a point to clone at, and a point a pool.
+    const bool point = cloneprompt || (machine.breakpoint >= 0);
+    if (((clones != 0) != point) || (script && point)) {
+        return usage(argv[0]);
+    }
+    if (script) {
+        if (!loadscript(script)) {
+            return 1;
+        }
+        // no one is waiting at the console, run idle time at full speed.
+        machine.cpu.unibus.kw11.virtualclock(virtualperiod);
+        realtime = false;
+    }
+    if (restore) {
+        // the snapshot names the packs.
+        if ((optind < argc) || rpunits) {
+            return usage(argv[0]);
+        }
+    } else if ((optind >= argc) || (argc - optind > 8)) {
+        // up to eight packs, in drive order.
+        return usage(argv[0]);
+    }
+    auto &bus = machine.cpu.unibus;
+    bus.rk11.policy = bus.rh11.policy = policy;
+    bus.rk11.readahead(readahead);
+    bus.rh11.readahead(readahead);
+    setup(&argv[optind], argc - optind, restore, realtime, !script);
+    if (script) {
+        runscript(machine);
+    }
+    while (machine.run() == STOPBREAK) {
+        spawnclones(machine);
+    }
+    printf("HALT: DR: %06o\n", machine.cpu.display());
+    machine.cpu.printstate();
+    machine.flush();
+    if (cloneid >= 0) {
+        // a clone's exit status is the low byte of the display register.
+        cloneexit(machine, machine.cpu.display() & 0377);
+    }
     std::abort();
 }
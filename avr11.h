@@ -10,10 +10,19 @@ enum {
     INTTTYIN = 0060,
     INTTTYOUT = 0064,
     INTFAULT = 0250,
+    INTRP = 0254,
     INTCLOCK = 0100,
     INTRK = 0220
 };
 
+// trapped is thrown by trap and caught by the run loop in machine.cc.
+struct trapped {
+    uint16_t vec;
+};
+
+// halted is thrown by HALT, it ends Machine::run.
+struct halted {};
+
 [[ noreturn ]] void trap(uint16_t num);
 
 
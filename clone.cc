@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "clone.h"
+#include "host.h"
+#include "machine.h"
+#include "match.h"
+
+uint32_t clones = 0, clonejobs = 0;
+const char *cloneprefix = "clone";
+const char *cloneprompt = nullptr;
+int32_t cloneid = -1;
+
+// redirect opens path with flags as fd, or fallback if path is missing.
+static bool redirect(const std::string &path, const int flags, const int fd,
+                     const char *fallback = nullptr) {
+    int f = open(path.c_str(), flags | O_CLOEXEC, 0666);
+    if ((f == -1) && (errno == ENOENT) && fallback) {
+        f = open(fallback, flags | O_CLOEXEC);
+    }
+    if ((f == -1) || (dup2(f, fd) == -1)) {
+        perror(path.c_str());
+        return false;
+    }
+    close(f);
+    return true;
+}
+
+// become makes this process clone id, which then carries on running the
+// machine.
+static void become(Machine &m, const uint32_t id) {
+    cloneid = id;
+    m.breakpoint = -1;
+    snapshotfile = nullptr;
+    const std::string prefix = cloneprefix + std::to_string(id);
+    if (!redirect(prefix + ".in", O_RDONLY, STDIN_FILENO, "/dev/null") ||
+        !redirect(prefix + ".tty", O_WRONLY | O_CREAT | O_TRUNC,
+                  STDOUT_FILENO) ||
+        (dup2(STDOUT_FILENO, STDERR_FILENO) == -1)) {
+        _exit(1);
+    }
+    auto &bus = m.cpu.unibus;
+    bus.sched.forked();
+    bus.cons.forked();
+    hostforked();
+    if (!bus.rk11.forked(prefix + ".") || !bus.rh11.forked(prefix + ".")) {
+        cloneexit(m, 1);
+    }
+}
+
+void spawnclones(Machine &m) {
+    if (cloneid >= 0) {
+        return;
+    }
+    // nothing may be in flight, or buffered, across fork, and the clones'
+    // overlays sit on what the packs hold now.
+    m.flush();
+    fflush(stdout);
+    fflush(stderr);
+
+    const uint32_t jobs = clonejobs ? clonejobs : sysconf(_SC_NPROCESSORS_ONLN);
+    std::map<pid_t, uint32_t> running;
+    uint32_t started = 0;
+    bool ok = true;
+    while ((started < clones) || !running.empty()) {
+        if ((started < clones) && (running.size() < jobs)) {
+            const pid_t pid = fork();
+            if (pid == 0) {
+                become(m, started);
+                return;
+            }
+            if (pid == -1) {
+                perror("fork");
+                ok = false;
+                clones = started;
+                continue;
+            }
+            running[pid] = started++;
+            continue;
+        }
+        int status;
+        const pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waitpid");
+            _exit(1);
+        }
+        const auto it = running.find(pid);
+        if (it == running.end()) {
+            continue;
+        }
+        if (WIFEXITED(status)) {
+            printf("clone %u: exit %d\n", it->second, WEXITSTATUS(status));
+            ok = ok && (WEXITSTATUS(status) == 0);
+        } else {
+            printf("clone %u: %s\n", it->second, strsignal(WTERMSIG(status)));
+            ok = false;
+        }
+        fflush(stdout);
+        running.erase(it);
+    }
+    // m was flushed before forking.
+    _exit(ok ? 0 : 1);
+}
+
+void clonewatch(Machine &m, const uint8_t c) {
+    static Matcher prompt(cloneprompt);
+    if (!prompt.feed(c)) {
+        return;
+    }
+    if (cloneid >= 0) {
+        if (m.cpu.unibus.cons.eof) {
+            cloneexit(m, 0);
+        }
+    } else if (m.breakpoint < 0) {
+        m.cpu.unibus.sched.signal(EVCLONE);
+    }
+}
+
+void cloneexit(Machine &m, const int status) {
+    m.flush();
+    fflush(stdout);
+    _exit(status);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+
+class Machine;
+
+// A clone pool runs many copies of the machine from one point in a single
+// boot. Once the machine reaches that point it is forked, clones at a
+// time, each clone sharing the parent's core with it copy on write. Clone
+// n reads its console input from prefix followed by n.in, or /dev/null if
+// there is none, writes its console output to prefixn.tty and writes to
+// its own overlay on each pack, prefixn.rk0 and so on. It exits when the
+// guest halts, with the low byte of the display register as its status,
+// or when it prints the prompt again once its input has all been read.
+
+// clones is the number of clones to run, none if zero, at most clonejobs
+// at once, or one for each host cpu if clonejobs is zero.
+extern uint32_t clones, clonejobs;
+extern const char *cloneprefix;
+
+// The machine is cloned once the cpu reaches its breakpoint, if it has
+// one, or otherwise once the console prints cloneprompt.
+extern const char *cloneprompt;
+
+// cloneid is the number of this clone, or negative in the parent.
+extern int32_t cloneid;
+
+// spawnclones forks the clones of m. The parent runs the pool until they
+// have all exited and then exits itself, with status 0 if all of them did.
+// In a clone it returns, with m ready to run on. It must run between
+// instructions.
+void spawnclones(Machine &m);
+
+// clonewatch follows m's console output c for cloneprompt.
+void clonewatch(Machine &m, uint8_t c);
+
+// cloneexit ends a clone of m with status.
+[[noreturn]] void cloneexit(Machine &m, int status);
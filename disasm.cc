@@ -6,8 +6,6 @@
 #include "kb11.h"
 #include "unibus.h"
 
-extern KB11 cpu;
-
 constexpr std::array<const char *, 8> rs = {"R0", "R1", "R2", "R3", "R4", "R5", "SP", "PC"};
 
 struct D {
@@ -20,8 +18,6 @@ struct D {
 
 enum { DD = 1 << 1, S = 1 << 2, RR = 1 << 3, O = 1 << 4, N = 1 << 5 };
 
-extern KB11 cpu;
-
 constexpr D disamtable[] = {
     {0177777, 0000001, "WAIT", 0, false},
     {0177777, 0000002, "RTI", 0, false},
@@ -89,23 +85,23 @@ constexpr D disamtable[] = {
     {0, 0, "", 0, false},
 };
 
-void disasmaddr(uint16_t m, uint32_t a) {
+void disasmaddr(UNIBUS &bus, uint16_t m, uint32_t a) {
     if (m & 7) {
         switch (m) {
         case 027:
             a += 2;
-            printf("$%06o", cpu.unibus.read16(a));
+            printf("$%06o", bus.read16(a));
             return;
         case 037:
             a += 2;
-            printf("*%06o", cpu.unibus.read16(a));
+            printf("*%06o", bus.read16(a));
             return;
         case 067:
             a += 2;
-            printf("*%06o", (a + 2 + (cpu.unibus.read16(a))) & 0xFFFF);
+            printf("*%06o", (a + 2 + (bus.read16(a))) & 0xFFFF);
             return;
         case 077:
-            printf("**%06o", (a + 2 + (cpu.unibus.read16(a))) & 0xFFFF);
+            printf("**%06o", (a + 2 + (bus.read16(a))) & 0xFFFF);
             return;
         }
     }
@@ -131,17 +127,17 @@ void disasmaddr(uint16_t m, uint32_t a) {
         break;
     case 060:
         a += 2;
-        printf("%06o (%s)", cpu.unibus.read16(a), rs[m & 7]);
+        printf("%06o (%s)", bus.read16(a), rs[m & 7]);
         break;
     case 070:
         a += 2;
-        printf("*%06o (%s)", cpu.unibus.read16(a), rs[m & 7]);
+        printf("*%06o (%s)", bus.read16(a), rs[m & 7]);
         break;
     }
 }
 
-void disasm(uint32_t a) {
-    const auto ins = cpu.unibus.read16(a);
+void disasm(UNIBUS &bus, uint32_t a) {
+    const auto ins = bus.read16(a);
 
     D l = {0, 0, "", 0, false};
     for (auto i = 0; disamtable[i].ins; i++) {
@@ -165,12 +161,12 @@ void disasm(uint32_t a) {
     switch (l.flag) {
     case S | DD:
         printf(" ");
-        disasmaddr(s, a);
+        disasmaddr(bus, s, a);
         printf(",");
         [[fallthrough]];
     case DD:
         printf(" ");
-        disasmaddr(d, a);
+        disasmaddr(bus, d, a);
         break;
     case RR | O:
         printf(" %s,", rs[(ins & 0700) >> 6]);
@@ -185,7 +181,7 @@ void disasm(uint32_t a) {
         break;
     case RR | DD:
         printf(" %s, ", rs[(ins & 0700) >> 6]);
-        disasmaddr(d, a);
+        disasmaddr(bus, d, a);
         [[fallthrough]];
     case RR:
         printf(" %s", rs[ins & 7]);
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "machine.h"
+#include "match.h"
+#include "words.h"
+
+// fleet runs many machines in one process on a pool of worker threads.
+// Each machine is run for a slice of instructions at a time, then put back
+// on its worker's queue. A worker whose queue is empty steals from the
+// others. The clock runs in virtual time.
+//
+// The job file describes one machine on each line, blank lines and those
+// starting with # are skipped:
+//
+//   name [rk=pack]... [rp=[rp04:|rp06:]pack]... [in=file] [log=file]
+//        [until=output] [limit=instructions]
+//
+// The machine boots from its first RK05 pack, reads its console input from
+// in, or nothing, and writes its console output to log, name.log unless
+// given. It finishes when the guest halts, when the console prints until,
+// or when limit instructions have executed. A value may be double quoted,
+// with \n, \r, \t, \" and \\ escapes.
+
+// instructions per clock tick, 50Hz at 1 MIPS.
+const uint32_t virtualperiod = 20000;
+
+// job is one machine of the fleet and the conditions which end its run.
+struct job {
+    std::string name;
+    std::unique_ptr<Machine> machine;
+    Matcher until;
+    uint64_t limit = 0;
+};
+
+// queue holds the jobs waiting for a worker. The owner takes from the
+// front and puts a job back at the end once its slice is over, thieves
+// take from the end.
+struct queue {
+    std::mutex mu;
+    std::deque<job *> jobs;
+};
+
+static std::vector<queue> *queues;
+static uint32_t slice = 1000000;
+
+// queued counts the jobs waiting in the queues, left those not finished.
+// Idle workers sleep on idle until either changes.
+static std::atomic<size_t> queued{0}, left{0};
+static std::mutex idlemu;
+static std::condition_variable idle;
+static std::atomic<bool> failed{false};
+
+// watch follows j's console output c for until.
+static void watch(job &j, const uint8_t c) {
+    if (j.until.feed(c)) {
+        j.machine->stop();
+    }
+}
+
+// create builds the job described by the words w.
+static bool create(job &j, const std::vector<std::string> &w) {
+    j.name = w[0];
+    std::vector<std::string> rk, rp;
+    std::string in = "/dev/null", log = j.name + ".log", until;
+    for (size_t i = 1; i < w.size(); i++) {
+        const auto eq = w[i].find('=');
+        const auto key = w[i].substr(0, eq);
+        const auto val = eq == std::string::npos ? "" : w[i].substr(eq + 1);
+        if (key == "rk") {
+            rk.push_back(val);
+        } else if (key == "rp") {
+            rp.push_back(val);
+        } else if (key == "in") {
+            in = val;
+        } else if (key == "log") {
+            log = val;
+        } else if (key == "until") {
+            until = val;
+        } else if (key == "limit") {
+            j.limit = strtoull(val.c_str(), nullptr, 0);
+        } else {
+            fprintf(stderr, "%s: unknown key %s\n", j.name.c_str(),
+                    key.c_str());
+            return false;
+        }
+    }
+    if (rk.empty() || (rk.size() > 8) || (rp.size() > 8)) {
+        fprintf(stderr, "%s: needs one to eight rk packs, at most eight rp\n",
+                j.name.c_str());
+        return false;
+    }
+    const int i = open(in.c_str(), O_RDONLY | O_CLOEXEC);
+    if (i == -1) {
+        perror(in.c_str());
+        return false;
+    }
+    const int o =
+        open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (o == -1) {
+        perror(log.c_str());
+        return false;
+    }
+    j.machine = std::make_unique<Machine>(i, o);
+    auto &bus = j.machine->cpu.unibus;
+    for (size_t u = 0; u < rk.size(); u++) {
+        if (!bus.rk11.attach(u, rk[u].c_str())) {
+            return false;
+        }
+    }
+    for (size_t u = 0; u < rp.size(); u++) {
+        const char *arg = rp[u].c_str();
+        bool rp04 = false;
+        if (!strncmp(arg, "rp04:", 5)) {
+            rp04 = true;
+            arg += 5;
+        } else if (!strncmp(arg, "rp06:", 5)) {
+            arg += 5;
+        }
+        if (!bus.rh11.attach(u, arg, rp04)) {
+            return false;
+        }
+    }
+    if (!until.empty()) {
+        j.until = Matcher(until);
+        bus.cons.watch = [&j](uint8_t c) { watch(j, c); };
+    }
+    bus.kw11.virtualclock(virtualperiod);
+    return true;
+}
+
+// finish reports how j ended, failing the fleet unless ok.
+static void finish(job &j, const char *how, const bool ok) {
+    j.machine->flush();
+    printf("%s: %s\n", j.name.c_str(), how);
+    if (!ok) {
+        failed = true;
+    }
+}
+
+// step runs j for a slice, returning true once it has finished.
+static bool step(job &j) {
+    auto &m = *j.machine;
+    uint32_t n = slice;
+    if (j.limit) {
+        const auto now = m.cpu.unibus.sched.now;
+        if (now >= j.limit) {
+            finish(j, "limit", false);
+            return true;
+        }
+        n = std::min<uint64_t>(n, j.limit - now);
+    }
+    switch (m.run(n)) {
+    case STOPHALT: {
+        // the exit status is the low byte of the display register.
+        const int status = m.cpu.display() & 0377;
+        finish(j, ("exit " + std::to_string(status)).c_str(), status == 0);
+        return true;
+    }
+    case STOPPED:
+        finish(j, "matched", true);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// take removes the next job from the front of q, or from its end for a
+// thief.
+static job *take(queue &q, const bool thief) {
+    std::lock_guard<std::mutex> l(q.mu);
+    if (q.jobs.empty()) {
+        return nullptr;
+    }
+    job *j;
+    if (thief) {
+        j = q.jobs.back();
+        q.jobs.pop_back();
+    } else {
+        j = q.jobs.front();
+        q.jobs.pop_front();
+    }
+    queued--;
+    return j;
+}
+
+static void worker(const size_t w) {
+    auto &qs = *queues;
+    while (left.load()) {
+        job *j = take(qs[w], false);
+        for (size_t i = 1; !j && (i < qs.size()); i++) {
+            j = take(qs[(w + i) % qs.size()], true);
+        }
+        if (!j) {
+            std::unique_lock<std::mutex> l(idlemu);
+            idle.wait(l, [] { return queued.load() || !left.load(); });
+            continue;
+        }
+        if (step(*j)) {
+            if (--left == 0) {
+                std::lock_guard<std::mutex> l(idlemu);
+                idle.notify_all();
+            }
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> l(qs[w].mu);
+            qs[w].jobs.push_back(j);
+            queued++;
+        }
+        std::lock_guard<std::mutex> l(idlemu);
+        idle.notify_one();
+    }
+}
+
+int usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t] [-j workers] [-q slice] jobfile\n", name);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    size_t workers = 0;
+    bool translate = false;
+    while ((opt = getopt(argc, argv, "j:q:t")) != -1) {
+        switch (opt) {
+        case 'j':
+            workers = strtoul(optarg, nullptr, 0);
+            break;
+        case 'q':
+            slice = strtoul(optarg, nullptr, 0);
+            break;
+        case 't':
+            translate = true;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if ((optind != argc - 1) || (slice == 0)) {
+        return usage(argv[0]);
+    }
+    FILE *f = fopen(argv[optind], "r");
+    if (f == nullptr) {
+        perror(argv[optind]);
+        return 1;
+    }
+    std::deque<job> jobs;
+    char *line = nullptr;
+    size_t cap = 0;
+    for (uint32_t n = 1; getline(&line, &cap, f) != -1; n++) {
+        std::vector<std::string> w;
+        if (!words(line, w)) {
+            fprintf(stderr, "%s:%u: unterminated quote\n", argv[optind], n);
+            return 1;
+        }
+        if (w.empty() || (w[0][0] == '#')) {
+            continue;
+        }
+        jobs.emplace_back();
+        if (!create(jobs.back(), w)) {
+            return 1;
+        }
+        jobs.back().machine->translate = translate;
+    }
+    free(line);
+    fclose(f);
+
+    if (workers == 0) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    workers = std::max<size_t>(1, std::min(workers, jobs.size()));
+    queues = new std::vector<queue>(workers);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].machine->cpu.reset();
+        (*queues)[i % workers].jobs.push_back(&jobs[i]);
+    }
+    queued = left = jobs.size();
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back(worker, w);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    fflush(stdout);
+    // each machine was flushed as it finished.
+    _exit(failed ? 1 : 0);
+}
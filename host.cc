@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <functional>
+#include <map>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+
+#include "clone.h"
+#include "host.h"
+#include "machine.h"
+
+const char *snapshotfile = nullptr;
+
+// machine is the one host events are passed to.
+static Machine *machine = nullptr;
+static bool realtime = false;
+
+// The host loop sleeps on epfd until one of the fds in ready has something
+// for the machine, and passes it on to the machine's scheduler, which runs
+// it at the next instruction boundary. ready is only changed while the
+// loop isn't running.
+static int epfd = -1, timer = -1, sigs = -1;
+static std::map<int, std::function<void()>> ready;
+
+// watch has the host loop call f whenever fd becomes readable.
+static void watch(const int fd, std::function<void()> f) {
+    struct epoll_event ev = {};
+    // edge triggered, the loop itself doesn't read the console.
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = fd;
+    // regular files and /dev/null can't be polled, the console looks for
+    // input from them straight away.
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        if (errno != EPERM) {
+            perror("epoll_ctl");
+        }
+        return;
+    }
+    ready[fd] = std::move(f);
+}
+
+static void loop() {
+    while (true) {
+        struct epoll_event evs[8];
+        const auto n = epoll_wait(epfd, evs, 8, -1);
+        for (int i = 0; i < n; i++) {
+            ready.at(evs[i].data.fd)();
+        }
+    }
+}
+
+// tick runs the clock once each time the timer is read, however many
+// expiries the read reports. Ticks overrun while the host was busy are
+// dropped rather than caught up.
+static void tick() {
+    uint64_t n;
+    if (read(timer, &n, sizeof(n)) == sizeof(n)) {
+        machine->cpu.unibus.sched.signal(EVCLOCK);
+    }
+}
+
+// signalled passes on SIGUSR1, which prints the disk cache counters, and
+// SIGUSR2, which writes a snapshot.
+static void signalled() {
+    struct signalfd_siginfo si;
+    while (read(sigs, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGUSR1) {
+            machine->cpu.unibus.sched.signal(EVSTATS);
+        } else if (si.ssi_signo == SIGUSR2) {
+            machine->cpu.unibus.sched.signal(EVSNAP);
+        }
+    }
+}
+
+// start sets the host loop up from scratch and starts its thread.
+static void start() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        return;
+    }
+    watch(STDIN_FILENO, [] { machine->cpu.unibus.cons.rxready(); });
+
+    // the signals arrive on sigs rather than interrupting the machine, so
+    // every thread must have them blocked. Threads inherit the mask of the
+    // one creating them.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    sigs = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigs == -1) {
+        perror("signalfd");
+    } else {
+        watch(sigs, signalled);
+    }
+
+    if (realtime) {
+        // the clock ticks every 20ms.
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        const struct itimerspec its = {
+            .it_interval = {.tv_sec = 0, .tv_nsec = 20000000},
+            .it_value = {.tv_sec = 0, .tv_nsec = 20000000},
+        };
+        if ((timer == -1) || (timerfd_settime(timer, 0, &its, NULL) == -1)) {
+            perror("timerfd");
+        } else {
+            watch(timer, tick);
+        }
+    }
+    std::thread(loop).detach();
+}
+
+// hostevent runs the events which belong to the host.
+static void hostevent(const enum event e) {
+    switch (e) {
+    case EVSNAP:
+        if (snapshotfile && savesnapshot(machine->cpu, snapshotfile)) {
+            fprintf(stderr, "snapshot: wrote %s\n", snapshotfile);
+        }
+        break;
+    case EVCLONE:
+        spawnclones(*machine);
+        break;
+    default:
+        break;
+    }
+}
+
+void hostattach(Machine &m, const bool rt) {
+    machine = &m;
+    realtime = rt;
+    m.cpu.unibus.sched.host = hostevent;
+    if (cloneprompt) {
+        m.cpu.unibus.cons.watch = [&m](uint8_t c) { clonewatch(m, c); };
+    }
+    start();
+}
+
+void hostforked() {
+    // the loop's thread stayed behind in the parent, along with any claim
+    // on its fds.
+    for (const int fd : {epfd, timer, sigs}) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    epfd = timer = sigs = -1;
+    ready.clear();
+    start();
+}
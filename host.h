@@ -0,0 +1,22 @@
+#pragma once
+
+class Machine;
+
+// The simulator runs a single machine, which host connects to the process.
+// A host loop on its own thread waits for console input, the real-time
+// clock and signals, and reports each to the machine's scheduler, so they
+// reach the machine between instructions. No signal handlers run.
+
+// snapshotfile is where a snapshot of the machine is written when SIGUSR2
+// arrives, nowhere if it is null.
+extern const char *snapshotfile;
+
+// hostattach connects m to the process and starts the host loop. Input on
+// stdin is passed to the console, SIGUSR1 prints the disk cache counters
+// and SIGUSR2 writes a snapshot. With realtime set, the clock ticks every
+// 20ms. It must be called before any other thread is started.
+void hostattach(Machine &m, bool realtime);
+
+// hostforked must run in a clone after fork, once stdin has been replaced,
+// to start a host loop of its own.
+void hostforked();
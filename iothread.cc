@@ -0,0 +1,53 @@
+#include <new>
+#include <thread>
+
+#include "iothread.h"
+
+void IOThread::submit(std::function<void()> j) {
+    {
+        std::lock_guard<std::mutex> l(mu);
+        job = std::move(j);
+        queued = true;
+        done = false;
+        if (!running) {
+            // the thread lives as long as the process.
+            std::thread(&IOThread::run, this).detach();
+            running = true;
+        }
+    }
+    cv.notify_all();
+}
+
+bool IOThread::finished() {
+    std::lock_guard<std::mutex> l(mu);
+    const bool d = done;
+    done = false;
+    return d;
+}
+
+void IOThread::drain() {
+    std::unique_lock<std::mutex> l(mu);
+    cv.wait(l, [this] { return !queued; });
+}
+
+void IOThread::forked() {
+    // the parent's thread may still be waiting on cv, start afresh rather
+    // than inherit its claim on it. The next submit starts a thread.
+    new (&mu) std::mutex;
+    new (&cv) std::condition_variable;
+    running = false;
+}
+
+void IOThread::run() {
+    std::unique_lock<std::mutex> l(mu);
+    while (true) {
+        cv.wait(l, [this] { return queued; });
+        l.unlock();
+        job();
+        l.lock();
+        queued = false;
+        done = true;
+        cv.notify_all();
+        sched.signal(ev);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#include "scheduler.h"
+
+// IOThread performs a controller's transfers off the cpu thread, one at a
+// time, so the guest runs on while they are in flight. It signals ev on
+// the scheduler as each finishes, for the controller to complete it on
+// the cpu thread.
+class IOThread {
+  public:
+    IOThread(Scheduler &sched, enum event ev) : sched(sched), ev(ev) {}
+
+    // submit hands job to the thread, starting it the first time. Only one
+    // job may be in flight.
+    void submit(std::function<void()> job);
+
+    // finished reports, once, that the job submitted last has finished.
+    bool finished();
+
+    // drain waits for the job in flight, if any, to finish.
+    void drain();
+
+    // forked must run in a clone after fork, which leaves the thread
+    // behind in the parent. The job in flight must have been drained first.
+    void forked();
+
+  private:
+    Scheduler &sched;
+    const enum event ev;
+
+    // mu guards job, queued and done, which pass jobs to and from the
+    // thread.
+    std::mutex mu;
+    std::condition_variable cv;
+    std::function<void()> job;
+    bool queued = false, done = false, running = false;
+
+    void run();
+};
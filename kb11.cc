@@ -8,7 +8,7 @@
 #include "bootrom.h"
 #include "kb11.h"
 
-void disasm(uint32_t ia);
+void disasm(UNIBUS &bus, uint32_t ia);
 
 void KB11::reset() {
     for (auto i = 0; i < 29; i++) {
@@ -21,9 +21,16 @@ void KB11::reset() {
 }
 
 inline uint16_t KB11::read16(const uint16_t va) {
+    if (const auto p = mmu.host<false>(va, currentmode())) {
+        return *p;
+    }
     const auto a = mmu.decode<false>(va, currentmode());
+    if (a >= IOBASE_18BIT) {
+        endblock = true;
+    }
     switch (a) {
     case 0777776:
+        flags();
         return PSW;
     case 0777774:
         return stacklimit;
@@ -37,7 +44,15 @@ inline uint16_t KB11::read16(const uint16_t va) {
 }
 
 inline void KB11::write16(const uint16_t va, const uint16_t v) {
+    if (const auto p = mmu.host<true>(va, currentmode())) {
+        *p = v;
+        invalidate((p - unibus.core.data()) << 1);
+        return;
+    }
     const auto a = mmu.decode<true>(va, currentmode());
+    if (a >= IOBASE_18BIT) {
+        endblock = true;
+    }
     switch (a) {
     case 0777776:
         writePSW(v);
@@ -49,60 +64,100 @@ inline void KB11::write16(const uint16_t va, const uint16_t v) {
         displayregister = v;
         break;
     default:
-        if (a == 0140000)
-            printstate();
         unibus.write16(a, v);
     }
 }
 
-// ADD 06SSDD
-void KB11::ADD(const uint16_t instr) {
-    const auto src = SS<2>(instr);
-    const auto da = DA<2>(instr);
-    const auto dst = read<2>(da);
-    const auto sum = src + dst;
-    write<2>(da, sum);
-    PSW &= 0xFFF0;
-    setNZ<2>(sum);
-    if (!((src ^ dst) & 0x8000) && ((dst ^ sum) & 0x8000)) {
-        PSW |= FLAGV;
+// settle folds the pending operation recorded in cc into the PSW
+// condition codes.
+void KB11::settle() {
+    const uint16_t msb = cc.len == 2 ? 0x8000 : 0x80;
+    const uint16_t max = cc.len == 2 ? 0xFFFF : 0xFF;
+    uint16_t res = cc.res;
+    uint16_t psw = PSW & 0xFFF0;
+    switch (cc.op) {
+    case CCNZ:
+        psw |= PSW & FLAGC;
+        break;
+    case CCNZV:
+        psw |= PSW & FLAGC;
+        if (res == msb) {
+            psw |= FLAGV;
+        }
+        break;
+    case CCTST:
+        break;
+    case CCCMP:
+        res = (cc.src - cc.dst) & max;
+        if (((cc.src ^ cc.dst) & msb) && (!((cc.dst ^ res) & msb))) {
+            psw |= FLAGV;
+        }
+        if (cc.src < cc.dst) {
+            psw |= FLAGC;
+        }
+        break;
+    case CCADD:
+        if (!((cc.src ^ cc.dst) & 0x8000) && ((cc.dst ^ res) & 0x8000)) {
+            psw |= FLAGV;
+        }
+        if ((int32_t(cc.src) + int32_t(cc.dst)) >= 0xFFFF) {
+            psw |= FLAGC;
+        }
+        break;
+    case CCSUB:
+        if (((cc.src ^ cc.dst) & 0x8000) && (!((cc.dst ^ res) & 0x8000))) {
+            psw |= FLAGV;
+        }
+        if (cc.src > cc.dst) {
+            psw |= FLAGC;
+        }
+        break;
     }
-    if ((int32_t(src) + int32_t(dst)) >= 0xFFFF) {
-        PSW |= FLAGC;
+    if (res & msb) {
+        psw |= FLAGN;
+    }
+    if ((res & max) == 0) {
+        psw |= FLAGZ;
     }
+    PSW = psw;
+    cc.op = CCPSW;
+}
+
+// ADD 06SSDD
+template <auto s, auto d> void KB11::ADD(const uint16_t instr) {
+    const auto src = SS<2, s>(instr);
+    const auto da = DA<2, d>(instr);
+    const auto dst = read<2, d>(da);
+    const auto sum = src + dst;
+    write<2, d>(da, sum);
+    lazy<2>(CCADD, sum, src, dst);
 }
 
 // SUB 16SSDD
-void KB11::SUB(const uint16_t instr) {
-    const auto val1 = SS<2>(instr);
-    const auto da = DA<2>(instr);
-    const auto val2 = read<2>(da);
+template <auto s, auto d> void KB11::SUB(const uint16_t instr) {
+    const auto val1 = SS<2, s>(instr);
+    const auto da = DA<2, d>(instr);
+    const auto val2 = read<2, d>(da);
     const auto uval = (val2 - val1) & 0xFFFF;
-    PSW &= 0xFFF0;
-    write<2>(da, uval);
-    setNZ<2>(uval);
-    if (((val1 ^ val2) & 0x8000) && (!((val2 ^ uval) & 0x8000))) {
-        PSW |= FLAGV;
-    }
-    if (val1 > val2) {
-        PSW |= FLAGC;
-    }
+    write<2, d>(da, uval);
+    lazy<2>(CCSUB, uval, val1, val2);
 }
 
 // MUL 070RSS
-void KB11::MUL(const uint16_t instr) {
+template <auto d> void KB11::MUL(const uint16_t instr) {
     const auto reg = (instr >> 6) & 7;
     int32_t val1 = R[reg];
     if (val1 & 0x8000) {
         val1 = -((0xFFFF ^ val1) + 1);
     }
-    int32_t val2 = read<2>(DA<2>(instr));
+    int32_t val2 = read<2, d>(DA<2, d>(instr));
     if (val2 & 0x8000) {
         val2 = -((0xFFFF ^ val2) + 1);
     }
     const auto sval = val1 * val2;
     R[reg] = sval >> 16;
     R[reg | 1] = sval & 0xFFFF;
+    flags();
     PSW &= 0xFFF0;
     if (sval < 1) {
         PSW |= FLAGN;
@@ -115,10 +170,11 @@ void KB11::MUL(const uint16_t instr) {
     }
 }
 
-void KB11::DIV(const uint16_t instr) {
+template <auto d> void KB11::DIV(const uint16_t instr) {
     const auto reg = (instr >> 6) & 7;
     const int32_t val1 = (R[reg] << 16) | (R[reg | 1]);
-    const int32_t val2 = read<2>(DA<2>(instr));
+    const int32_t val2 = read<2, d>(DA<2, d>(instr));
+    flags();
     PSW &= 0xFFF0;
     if (val2 == 0) {
         PSW |= FLAGC;
@@ -141,10 +197,11 @@ void KB11::DIV(const uint16_t instr) {
     }
 }
 
-void KB11::ASH(const uint16_t instr) {
+template <auto d> void KB11::ASH(const uint16_t instr) {
     const auto reg = (instr >> 6) & 7;
     const auto val1 = R[reg];
-    auto val2 = read<2>(DA<2>(instr)) & 077;
+    auto val2 = read<2, d>(DA<2, d>(instr)) & 077;
+    flags();
     PSW &= 0xFFF0;
     int32_t sval;
     if (val2 & 040) {
@@ -174,10 +231,11 @@ void KB11::ASH(const uint16_t instr) {
     }
 }
 
-void KB11::ASHC(const uint16_t instr) {
+template <auto d> void KB11::ASHC(const uint16_t instr) {
     const auto reg = (instr >> 6) & 7;
     const auto val1 = ((uint32_t)(R[reg]) << 16) | R[reg | 1];
-    auto val2 = read<2>(DA<2>(instr)) & 077;
+    auto val2 = read<2, d>(DA<2, d>(instr)) & 077;
+    flags();
     PSW &= 0xFFF0;
     int32_t sval;
     if (val2 & 040) {
@@ -209,11 +267,11 @@ void KB11::ASHC(const uint16_t instr) {
 }
 
 // XOR 064RDD
-void KB11::XOR(const uint16_t instr) {
+template <auto d> void KB11::XOR(const uint16_t instr) {
     const auto reg = R[(instr >> 6) & 7];
-    const auto da = DA<2>(instr);
-    const auto dst = reg ^ read<2>(da);
-    write<2>(da, dst);
+    const auto da = DA<2, d>(instr);
+    const auto dst = reg ^ read<2, d>(da);
+    write<2, d>(da, dst);
     setNZ<2>(dst);
 }
 
@@ -227,13 +285,13 @@ void KB11::SOB(const uint16_t instr) {
 }
 
 // JSR 004RDD
-void KB11::JSR(const uint16_t instr) {
-    if (((instr >> 3) & 7) == 0) {
+template <auto d> void KB11::JSR(const uint16_t instr) {
+    if constexpr (d == 0) {
         printf("JSR called on register\n");
         printstate();
         std::abort();
     }
-    const auto dst = DA<2>(instr);
+    const auto dst = DA<2, d>(instr);
     const auto reg = (instr >> 6) & 7;
     push(R[reg]);
     R[reg] = R[7];
@@ -241,14 +299,14 @@ void KB11::JSR(const uint16_t instr) {
 }
 
 // JMP 0001DD
-void KB11::JMP(const uint16_t instr) {
-    if (((instr >> 3) & 7) == 0) {
+template <auto d> void KB11::JMP(const uint16_t instr) {
+    if constexpr (d == 0) {
         // Registers don't have a virtual address so trap!
         printf("JMP called on register\n");
         printstate();
         std::abort();
     }
-    R[7] = DA<2>(instr);
+    R[7] = DA<2, d>(instr);
 }
 
 // MARK 0064NN
@@ -259,9 +317,9 @@ void KB11::MARK(const uint16_t instr) {
 }
 
 // MFPI 0065SS
-void KB11::MFPI(const uint16_t instr) {
+template <auto d> void KB11::MFPI(const uint16_t instr) {
     uint16_t uval;
-    if (!(instr & 0x38)) {
+    if constexpr (d == 0) {
         const auto reg = instr & 7;
         if ((reg != 6) || (currentmode() == previousmode())) {
             uval = R[reg];
@@ -269,7 +327,7 @@ void KB11::MFPI(const uint16_t instr) {
             uval = stackpointer[previousmode()];
         }
     } else {
-        const auto da = DA<2>(instr);
+        const auto da = DA<2, d>(instr);
         uval = unibus.read16(mmu.decode<false>(da, previousmode()));
     }
     push(uval);
@@ -277,9 +335,9 @@ void KB11::MFPI(const uint16_t instr) {
 }
 
 // MTPI 0066DD
-void KB11::MTPI(const uint16_t instr) {
+template <auto d> void KB11::MTPI(const uint16_t instr) {
     const auto uval = pop();
-    if (!(instr & 0x38)) {
+    if constexpr (d == 0) {
         const auto reg = instr & 7;
         if ((reg != 6) || (currentmode() == previousmode())) {
             R[reg] = uval;
@@ -287,7 +345,7 @@ void KB11::MTPI(const uint16_t instr) {
             stackpointer[previousmode()] = uval;
         }
     } else {
-        const auto da = DA<2>(instr);
+        const auto da = DA<2, d>(instr);
         unibus.write16(mmu.decode<true>(da, previousmode()), uval);
     }
     setNZ<2>(uval);
@@ -301,12 +359,12 @@ void KB11::RTS(const uint16_t instr) {
 }
 
 // MFPT 000007
-void KB11::MFPT() {
+void KB11::MFPT(const uint16_t) {
     trapat(010); // not a PDP11/44
 }
 
 // RTI 000004, RTT 000006
-void KB11::RTT() {
+void KB11::RTT(const uint16_t) {
     R[7] = pop();
     auto psw = pop();
     psw &= 0xf8ff;
@@ -317,9 +375,25 @@ void KB11::RTT() {
     writePSW(psw);
 }
 
-void KB11::WAIT() { pause(); }
+// WAIT 000001
+void KB11::WAIT(const uint16_t) {
+    // idle until there is an interrupt to take.
+    waiting = true;
+    while (irq().vec == 0) {
+        unibus.sched.wait();
+        if (unibus.sched.due()) {
+            unibus.sched.run();
+        }
+        if (unibus.sched.yielding) {
+            // the slice is over, WAIT again when the machine next runs.
+            R[7] = PC;
+            break;
+        }
+    }
+    waiting = false;
+}
 
-void KB11::RESET() {
+void KB11::RESET(const uint16_t) {
     if (currentmode()) {
         // RESET is ignored outside of kernel mode
         return;
@@ -328,11 +402,12 @@ void KB11::RESET() {
 }
 
 // SWAB 0003DD
-void KB11::SWAB(const uint16_t instr) {
-    const auto da = DA<2>(instr);
-    auto dst = read<2>(da);
+template <auto d> void KB11::SWAB(const uint16_t instr) {
+    const auto da = DA<2, d>(instr);
+    auto dst = read<2, d>(da);
     dst = (dst << 8) | (dst >> 8);
-    write<2>(da, dst);
+    write<2, d>(da, dst);
+    flags();
     PSW &= 0xFFF0;
     if ((dst & 0xff00) == 0) {
         PSW |= FLAGZ;
@@ -343,400 +418,453 @@ void KB11::SWAB(const uint16_t instr) {
 }
 
 // SXT 0067DD
-void KB11::SXT(const uint16_t instr) {
+template <auto d> void KB11::SXT(const uint16_t instr) {
+    flags();
     if (N()) {
-        write<2>(DA<2>(instr), 0xffff);
+        write<2, d>(DA<2, d>(instr), 0xffff);
         PSW &= ~FLAGZ;
     } else {
-        write<2>(DA<2>(instr), 0);
+        write<2, d>(DA<2, d>(instr), 0);
         PSW |= FLAGZ;
     }
     PSW &= ~FLAGV;
 }
 
+// HALT 000000
+void KB11::HALT(const uint16_t) {
+    throw halted{};
+}
+
+// BPT 000003
+void KB11::BPT(const uint16_t) {
+    trapat(014); // Trap 14 - BPT
+}
+
+// IOT 000004
+void KB11::IOT(const uint16_t) { trapat(020); }
+
+// EMT 1040 operand
+void KB11::EMT(const uint16_t) {
+    trapat(030); // Trap 30 - EMT instruction
+}
+
+// TRAP 1044 operand
+void KB11::TRAP(const uint16_t) {
+    trapat(034); // Trap 34 - TRAP instruction
+}
+
+// SPL 00023N
+void KB11::SPL(const uint16_t instr) {
+    flags();
+    writePSW((PSW & 0xf81f) | ((instr & 7) << 5));
+}
+
+// CLR CC 00024C, 00025C
+void KB11::CCC(const uint16_t instr) {
+    flags();
+    writePSW(PSW & (~instr & 017));
+}
+
+// SET CC 00026C, 00027C
+void KB11::SCC(const uint16_t instr) {
+    flags();
+    writePSW(PSW | (instr & 017));
+}
+
+// SETD 170011 ; not needed by UNIX, but used; therefore ignored
+void KB11::SETD(const uint16_t) {}
+
+void KB11::INVAL(const uint16_t instr) {
+    printf("unknown instruction %06o\n", instr);
+    printstate();
+    trapat(INTINVAL);
+}
+
+// BR 0004 offset
+void KB11::BR(const uint16_t instr) { branch(instr); }
+
+// BNE 0010 offset
+void KB11::BNE(const uint16_t instr) {
+    if (!Z()) {
+        branch(instr);
+    }
+}
+
+// BEQ 0014 offset
+void KB11::BEQ(const uint16_t instr) {
+    if (Z()) {
+        branch(instr);
+    }
+}
+
+// BGE 0020 offset
+void KB11::BGE(const uint16_t instr) {
+    if (!(N() xor V())) {
+        branch(instr);
+    }
+}
+
+// BLT 0024 offset
+void KB11::BLT(const uint16_t instr) {
+    if (N() xor V()) {
+        branch(instr);
+    }
+}
+
+// BGT 0030 offset
+void KB11::BGT(const uint16_t instr) {
+    if ((!(N() xor V())) && (!Z())) {
+        branch(instr);
+    }
+}
+
+// BLE 0034 offset
+void KB11::BLE(const uint16_t instr) {
+    if ((N() xor V()) || Z()) {
+        branch(instr);
+    }
+}
+
+// BPL 1000 offset
+void KB11::BPL(const uint16_t instr) {
+    if (!N()) {
+        branch(instr);
+    }
+}
+
+// BMI 1004 offset
+void KB11::BMI(const uint16_t instr) {
+    if (N()) {
+        branch(instr);
+    }
+}
+
+// BHI 1010 offset
+void KB11::BHI(const uint16_t instr) {
+    if ((!C()) && (!Z())) {
+        branch(instr);
+    }
+}
+
+// BLOS 1014 offset
+void KB11::BLOS(const uint16_t instr) {
+    if (C() || Z()) {
+        branch(instr);
+    }
+}
+
+// BVC 1020 offset
+void KB11::BVC(const uint16_t instr) {
+    if (!V()) {
+        branch(instr);
+    }
+}
+
+// BVS 1024 offset
+void KB11::BVS(const uint16_t instr) {
+    if (V()) {
+        branch(instr);
+    }
+}
+
+// BCC 1030 offset
+void KB11::BCC(const uint16_t instr) {
+    if (!C()) {
+        branch(instr);
+    }
+}
+
+// BCS 1034 offset
+void KB11::BCS(const uint16_t instr) {
+    if (C()) {
+        branch(instr);
+    }
+}
+
 void KB11::step() {
     PC = R[7];
-    const auto instr = fetch16();
+    uint16_t instr;
+    if (const auto p = mmu.host<false>(PC, currentmode())) {
+        instr = *p;
+        R[7] += 2;
+    } else {
+        // odd and I/O page addresses take the slow path.
+        instr = fetch16();
+    }
 
     if (print)
         printstate();
 
-    switch (instr >> 12) {    // xxSSDD Mostly double operand instructions
-    case 0:                   // 00xxxx mixed group
-        switch (instr >> 8) { // 00xxxx 8 bit instructions first (branch & JSR)
-        case 0:               // 000xXX Misc zero group
-            switch (instr >> 6) { // 000xDD group (4 case full decode)
-            case 0:               // 0000xx group
-                switch (instr) {
-                case 0: // HALT 000000
-                    printf("HALT: DR: %06o\n", displayregister);
-                    printstate();
-                    std::abort();
-                case 1: // WAIT 000001
-                    WAIT();
-                    return;
-                case 3:          // BPT  000003
-                    trapat(014); // Trap 14 - BPT
-                    return;
-                case 4: // IOT  000004
-                    trapat(020);
-                    return;
-                case 5: // RESET 000005
-                    RESET();
-                    return;
-                case 2: // RTI 000002
-                case 6: // RTT 000006
-                    RTT();
-                    return;
-                case 7: // MFPT
-                    MFPT();
-                    return;
-                default: // We don't know this 0000xx instruction
-                    printf("unknown 0000xx instruction\n");
-                    printstate();
-                    trapat(INTINVAL);
-                    return;
-                }
-            case 1: // JMP 0001DD
-                JMP(instr);
-                return;
-            case 2:                         // 00002xR single register group
-                switch ((instr >> 3) & 7) { // 00002xR register or CC
-                case 0:                     // RTS 00020R
-                    RTS(instr);
-                    return;
-                case 3: // SPL 00023N
-                    writePSW((PSW & 0xf81f) | ((instr & 7) << 5));
-                    return;
-                case 4: // CLR CC 00024C Part 1 without N
-                case 5: // CLR CC 00025C Part 2 with N
-                    writePSW(PSW & (~instr & 017));
-                    return;
-                case 6: // SET CC 00026C Part 1 without N
-                case 7: // SET CC 00027C Part 2 with N
-                    writePSW(PSW | (instr & 017));
-                    return;
-                default: // We don't know this 00002xR instruction
-                    printf("unknown 0002xR instruction\n");
-                    printstate();
-                    trapat(INTINVAL);
-                    return;
-                }
-            case 3: // SWAB 0003DD
-                SWAB(instr);
-                return;
-            default:
-                printf("unknown 000xDD instruction\n");
-                printstate();
-                trapat(INTINVAL);
-                return;
-            }
-        case 1: // BR 0004 offset
-            branch(instr);
-            return;
-        case 2: // BNE 0010 offset
-            if (!Z()) {
-                branch(instr);
-            }
-            return;
-        case 3: // BEQ 0014 offset
-            if (Z()) {
-                branch(instr);
-            }
-            return;
-        case 4: // BGE 0020 offset
-            if (!(N() xor V())) {
-                branch(instr);
-            }
-            return;
-        case 5: // BLT 0024 offset
-            if (N() xor V()) {
-                branch(instr);
-            }
-            return;
-        case 6: // BGT 0030 offset
-            if ((!(N() xor V())) && (!Z())) {
-                branch(instr);
-            }
-            return;
-        case 7: // BLE 0034 offset
-            if ((N() xor V()) || Z()) {
-                branch(instr);
-            }
-            return;
-        case 8: // JSR 004RDD In two parts
-        case 9: // JSR 004RDD continued (9 bit instruction so use 2 x 8 bit
-            JSR(instr);
-            return;
-        default: // Remaining 0o00xxxx instructions where xxxx >= 05000
-            switch (instr >> 6) { // 00xxDD
-            case 050:             // CLR 0050DD
-                CLR<2>(instr);
-                return;
-            case 051: // COM 0051DD
-                COM<2>(instr);
-                return;
-            case 052: // INC 0052DD
-                INC<2>(instr);
-                return;
-            case 053: // DEC 0053DD
-                _DEC<2>(instr);
-                return;
-            case 054: // NEG 0054DD
-                NEG<2>(instr);
-                return;
-            case 055: // ADC 0055DD
-                _ADC<2>(instr);
-                return;
-            case 056: // SBC 0056DD
-                SBC<2>(instr);
-                return;
-            case 057: // TST 0057DD
-                TST<2>(instr);
-                return;
-            case 060: // ROR 0060DD
-                ROR<2>(instr);
-                return;
-            case 061: // ROL 0061DD
-                ROL<2>(instr);
-                return;
-            case 062: // ASR 0062DD
-                ASR<2>(instr);
-                return;
-            case 063: // ASL 0063DD
-                ASL<2>(instr);
-                return;
-            case 064: // MARK 0064nn
-                MARK(instr);
-                return;
-            case 065: // MFPI 0065SS
-                MFPI(instr);
-                return;
-            case 066: // MTPI 0066DD
-                MTPI(instr);
-                return;
-            case 067: // SXT 0067DD
-                SXT(instr);
-                return;
-            default: // We don't know this 0o00xxDD instruction
-                printf("unknown 00xxDD instruction\n");
-                printstate();
-                trapat(INTINVAL);
-                return;
-            }
+    (this->*dispatch[instr])(instr);
+}
+
+uint8_t KB11::stepblock() {
+    if (blocks.empty()) {
+        blocks.resize(8192);
+    }
+    const auto mode = currentmode();
+    const auto a = mmu.decode<false>(R[7], mode);
+    if ((a & 1) || (a >= IOBASE_18BIT)) {
+        step();
+        return 1;
+    }
+    auto &b = blocks[(a >> 1) & (blocks.size() - 1)];
+    if ((b.pa != a) || (b.mode != mode)) {
+        // first visit, claim the slot and interpret until it gets hot.
+        b.pa = a;
+        b.mode = mode;
+        b.epoch = 0;
+        b.heat = 1;
+        step();
+        return 1;
+    }
+    if (b.epoch != epoch) {
+        if (b.heat < 8) {
+            b.heat++;
+            step();
+            return 1;
         }
-    case 1: // MOV  01SSDD
-        MOV<2>(instr);
-        return;
-    case 2: // CMP 02SSDD
-        CMP<2>(instr);
-        return;
-    case 3: // BIT 03SSDD
-        BIT<2>(instr);
-        return;
-    case 4: // BIC 04SSDD
-        BIC<2>(instr);
-        return;
-    case 5: // BIS 05SSDD
-        BIS<2>(instr);
-        return;
-    case 6: // ADD 06SSDD
-        ADD(instr);
-        return;
-    case 7:                         // 07xRSS instructions
-        switch ((instr >> 9) & 7) { // 07xRSS
-        case 0:                     // MUL 070RSS
-            MUL(instr);
-            return;
-        case 1: // DIV 071RSS
-            DIV(instr);
-            return;
-        case 2: // ASH 072RSS
-            ASH(instr);
-            return;
-        case 3: // ASHC 073RSS
-            ASHC(instr);
-            return;
-        case 4: // XOR 074RSS
-            XOR(instr);
-            return;
-        case 7: // SOB 077Rnn
-            SOB(instr);
-            return;
-        default: // We don't know this 07xRSS instruction
-            printf("unknown 07xRSS instruction\n");
+        translate(b, a);
+    }
+
+    endblock = false;
+    for (auto i = 0; i < b.len; i++) {
+        const auto &o = b.ops[i];
+        PC = R[7];
+        R[7] += 2;
+
+        if (print)
             printstate();
-            trapat(INTINVAL);
-            return;
-        }
-    case 8:                           // 10xxxx instructions
-        switch ((instr >> 8) & 0xf) { // 10xxxx 8 bit instructions first
-        case 0:                       // BPL 1000 offset
-            if (!N()) {
-                branch(instr);
-            }
-            return;
-        case 1: // BMI 1004 offset
-            if (N()) {
-                branch(instr);
-            }
-            return;
-        case 2: // BHI 1010 offset
-            if ((!C()) && (!Z())) {
-                branch(instr);
-            }
-            return;
-        case 3: // BLOS 1014 offset
-            if (C() || Z()) {
-                branch(instr);
-            }
-            return;
-        case 4: // BVC 1020 offset
-            if (!V()) {
-                branch(instr);
-            }
-            return;
-        case 5: // BVS 1024 offset
-            if (V()) {
-                branch(instr);
-            }
-            return;
-        case 6: // BCC 1030 offset
-            if (!C()) {
-                branch(instr);
-            }
-            return;
-        case 7: // BCS 1034 offset
-            if (C()) {
-                branch(instr);
-            }
-            return;
-        case 8:          // EMT 1040 operand
-            trapat(030); // Trap 30 - EMT instruction
-            return;
-        case 9:          // TRAP 1044 operand
-            trapat(034); // Trap 34 - TRAP instruction
-            return;
-        default: // Remaining 10xxxx instructions where xxxx >= 05000
-            switch ((instr >> 6) & 077) { // 10xxDD group
-            case 050:                     // CLRB 1050DD
-                CLR<1>(instr);
-                return;
-            case 051: // COMB 1051DD
-                COM<1>(instr);
-                return;
-            case 052: // INCB 1052DD
-                INC<1>(instr);
-                return;
-            case 053: // DECB 1053DD
-                _DEC<1>(instr);
-                return;
-            case 054: // NEGB 1054DD
-                NEG<1>(instr);
-                return;
-            case 055: // ADCB 01055DD
-                _ADC<1>(instr);
-                return;
-            case 056: // SBCB 01056DD
-                SBC<1>(instr);
-                return;
-            case 057: // TSTB 1057DD
-                TST<1>(instr);
-                return;
-            case 060: // RORB 1060DD
-                ROR<1>(instr);
-                return;
-            case 061: // ROLB 1061DD
-                ROL<1>(instr);
-                return;
-            case 062: // ASRB 1062DD
-                ASR<1>(instr);
-                return;
-            case 063: // ASLB 1063DD
-                ASL<1>(instr);
-                return;
-            // case 0o64: // MTPS 1064SS
-            // case 0o65: // MFPD 1065DD
-            // case 0o66: // MTPD 1066DD
-            // case 0o67: // MTFS 1064SS
-            default: // We don't know this 0o10xxDD instruction
-                printf("unknown 0o10xxDD instruction\n");
-                printstate();
-                trapat(INTINVAL);
-                return;
-            }
+
+        (this->*o.fn)(o.instr);
+        if ((R[7] != uint16_t(PC + (o.len << 1))) || endblock) {
+            return i + 1;
         }
-    case 9: // MOVB 11SSDD
-        MOV<1>(instr);
-        return;
-    case 10: // CMPB 12SSDD
-        CMP<1>(instr);
-        return;
-    case 11: // BITB 13SSDD
-        BIT<1>(instr);
-        return;
-    case 12: // BICB 14SSDD
-        BIC<1>(instr);
-        return;
-    case 13: // BISB 15SSDD
-        BIS<1>(instr);
-        return;
-    case 14: // SUB 16SSDD
-        SUB(instr);
-        return;
-    case 15:
-        if (instr == 0170011) {
-            // SETD ; not needed by UNIX, but used; therefore ignored
-            return;
+    }
+    return b.len;
+}
+
+void KB11::translate(block &b, const uint32_t a) {
+    b.epoch = epoch;
+    b.len = 0;
+    code[a >> 6] = epoch;
+    for (auto pa = a; (pa >> 6) == (a >> 6) && b.len < b.ops.size();) {
+        const auto instr = unibus.core[pa >> 1];
+        const auto len = length(instr);
+        b.ops[b.len++] = {dispatch[instr], instr, len};
+        pa += len << 1;
+        if ((instr < 0000010) || ((instr & 0177700) == 0000100) ||
+            ((instr & 0177770) == 0000200) || ((instr & 0177770) == 0000230) ||
+            ((instr & 0177400) == 0000400) || ((instr & 0177000) == 0104000)) {
+            // HALT to MFPT, JMP, RTS, BR, EMT and TRAP never fall through,
+            // SPL may unmask a pending interrupt.
+            break;
         }
-        [[fallthrough]];
-    default: // 15  17xxxx FPP instructions
-        printf("invalid 17xxxx FPP instruction\n");
-        printstate();
-        trapat(INTINVAL);
     }
 }
 
-void KB11::interrupt(uint8_t vec, uint8_t pri) {
-    if (vec & 1) {
-        printf("Thou darst calling interrupt() with an odd vector number?\n");
-        std::abort();
+// length returns the number of words in instr, including the index and
+// immediate words of its operands.
+uint8_t KB11::length(const uint16_t instr) {
+    auto words = [](const uint16_t m) {
+        const auto mode = (m >> 3) & 7;
+        return (mode >= 6) || (((m & 7) == 7) && (mode == 2 || mode == 3));
+    };
+    switch (instr >> 12) {
+    case 0:
+        if (((instr & 0177700) == 0000100) || ((instr & 0177700) == 0000300) ||
+            ((instr & 0177000) == 0004000) ||
+            ((instr >= 0005000) && (instr < 0007000) &&
+             ((instr & 0177700) != 0006400))) {
+            // JMP, SWAB, JSR, single operand, MFPI, MTPI and SXT
+            return 1 + words(instr);
+        }
+        return 1;
+    case 7:
+        if (((instr >> 9) & 7) <= 4) {
+            // MUL, DIV, ASH, ASHC and XOR
+            return 1 + words(instr);
+        }
+        return 1;
+    case 8:
+        if ((instr >= 0105000) && (instr < 0106400)) {
+            return 1 + words(instr);
+        }
+        return 1;
+    case 15:
+        return 1;
+    default:
+        return 1 + words(instr >> 6) + words(instr);
     }
-    // fast path
-    if (itab[0].vec == 0) {
-        itab[0].vec = vec;
-        itab[0].pri = pri;
-        return;
+}
+
+void KB11::flush() {
+    endblock = true;
+    if (++epoch == 0) {
+        // wrapped, forget everything from the previous cycle.
+        epoch = 1;
+        for (auto &b : blocks) {
+            b.epoch = 0;
+        }
+        code.fill(0);
     }
-    uint8_t i = 0;
-    for (; i < itab.size(); i++) {
-        if ((itab[i].vec == 0) || (itab[i].pri < pri)) {
-            break;
+}
+
+constexpr std::array<KB11::handler, 65536> KB11::maketable() {
+    const auto jmp = dd([](auto d) { return &KB11::JMP<d.value>; });
+    const auto swab = dd([](auto d) { return &KB11::SWAB<d.value>; });
+    const auto jsr = dd([](auto d) { return &KB11::JSR<d.value>; });
+    const auto mfpi = dd([](auto d) { return &KB11::MFPI<d.value>; });
+    const auto mtpi = dd([](auto d) { return &KB11::MTPI<d.value>; });
+    const auto sxt = dd([](auto d) { return &KB11::SXT<d.value>; });
+    const auto mul = dd([](auto d) { return &KB11::MUL<d.value>; });
+    const auto div = dd([](auto d) { return &KB11::DIV<d.value>; });
+    const auto ash = dd([](auto d) { return &KB11::ASH<d.value>; });
+    const auto ashc = dd([](auto d) { return &KB11::ASHC<d.value>; });
+    const auto xor_ = dd([](auto d) { return &KB11::XOR<d.value>; });
+
+    // 0050DD - 0063DD and 1050DD - 1063DD single operand group
+    const std::array<std::array<handler, 8>, 014> sop[2] = {{
+        dd([](auto d) { return &KB11::CLR<2, d.value>; }),
+        dd([](auto d) { return &KB11::COM<2, d.value>; }),
+        dd([](auto d) { return &KB11::INC<2, d.value>; }),
+        dd([](auto d) { return &KB11::_DEC<2, d.value>; }),
+        dd([](auto d) { return &KB11::NEG<2, d.value>; }),
+        dd([](auto d) { return &KB11::_ADC<2, d.value>; }),
+        dd([](auto d) { return &KB11::SBC<2, d.value>; }),
+        dd([](auto d) { return &KB11::TST<2, d.value>; }),
+        dd([](auto d) { return &KB11::ROR<2, d.value>; }),
+        dd([](auto d) { return &KB11::ROL<2, d.value>; }),
+        dd([](auto d) { return &KB11::ASR<2, d.value>; }),
+        dd([](auto d) { return &KB11::ASL<2, d.value>; }),
+    }, {
+        dd([](auto d) { return &KB11::CLR<1, d.value>; }),
+        dd([](auto d) { return &KB11::COM<1, d.value>; }),
+        dd([](auto d) { return &KB11::INC<1, d.value>; }),
+        dd([](auto d) { return &KB11::_DEC<1, d.value>; }),
+        dd([](auto d) { return &KB11::NEG<1, d.value>; }),
+        dd([](auto d) { return &KB11::_ADC<1, d.value>; }),
+        dd([](auto d) { return &KB11::SBC<1, d.value>; }),
+        dd([](auto d) { return &KB11::TST<1, d.value>; }),
+        dd([](auto d) { return &KB11::ROR<1, d.value>; }),
+        dd([](auto d) { return &KB11::ROL<1, d.value>; }),
+        dd([](auto d) { return &KB11::ASR<1, d.value>; }),
+        dd([](auto d) { return &KB11::ASL<1, d.value>; }),
+    }};
+
+    // 01SSDD - 06SSDD and 11SSDD - 16SSDD double operand group
+    const std::array<std::array<handler, 64>, 6> dop[2] = {{
+        ssdd([](auto s, auto d) { return &KB11::MOV<2, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::CMP<2, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::BIT<2, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::BIC<2, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::BIS<2, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::ADD<s.value, d.value>; }),
+    }, {
+        ssdd([](auto s, auto d) { return &KB11::MOV<1, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::CMP<1, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::BIT<1, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::BIC<1, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::BIS<1, s.value, d.value>; }),
+        ssdd([](auto s, auto d) { return &KB11::SUB<s.value, d.value>; }),
+    }};
+
+    // branches, EMT and TRAP by bits 15 and 8-10
+    const std::array<handler, 8> br[2] = {
+        {&KB11::INVAL, &KB11::BR, &KB11::BNE, &KB11::BEQ, &KB11::BGE,
+         &KB11::BLT, &KB11::BGT, &KB11::BLE},
+        {&KB11::BPL, &KB11::BMI, &KB11::BHI, &KB11::BLOS, &KB11::BVC,
+         &KB11::BVS, &KB11::BCC, &KB11::BCS},
+    };
+
+    std::array<handler, 65536> t{};
+    for (uint32_t i = 0; i < t.size(); i++) {
+        t[i] = &KB11::INVAL;
+    }
+
+    t[0000000] = &KB11::HALT;
+    t[0000001] = &KB11::WAIT;
+    t[0000002] = &KB11::RTT; // RTI
+    t[0000003] = &KB11::BPT;
+    t[0000004] = &KB11::IOT;
+    t[0000005] = &KB11::RESET;
+    t[0000006] = &KB11::RTT;
+    t[0000007] = &KB11::MFPT;
+    for (auto i = 0; i < 010; i++) {
+        t[0000200 | i] = &KB11::RTS;
+        t[0000230 | i] = &KB11::SPL;
+    }
+    for (auto i = 0; i < 020; i++) {
+        t[0000240 | i] = &KB11::CCC;
+        t[0000260 | i] = &KB11::SCC;
+    }
+    for (auto i = 0; i < 0100; i++) {
+        t[0000100 | i] = jmp[i >> 3];
+        t[0000300 | i] = swab[i >> 3];
+        t[0006400 | i] = &KB11::MARK;
+        t[0006500 | i] = mfpi[i >> 3];
+        t[0006600 | i] = mtpi[i >> 3];
+        t[0006700 | i] = sxt[i >> 3];
+        for (auto b = 0; b < 2; b++) {
+            for (auto op = 0; op < 014; op++) {
+                t[(b << 15) | (0005000 + (op << 6)) | i] = sop[b][op][i >> 3];
+            }
         }
     }
-    for (; i < itab.size(); i++) {
-        if ((itab[i].vec == 0) || (itab[i].vec >= vec)) {
-            break;
+    for (auto i = 0; i < 0400; i++) {
+        for (auto b = 0; b < 2; b++) {
+            for (auto op = 0; op < 8; op++) {
+                if (b || op) {
+                    t[(b << 15) | (op << 8) | i] = br[b][op];
+                }
+            }
+        }
+        t[0104000 | i] = &KB11::EMT;
+        t[0104400 | i] = &KB11::TRAP;
+    }
+    for (auto i = 0; i < 01000; i++) {
+        t[0004000 | i] = jsr[(i >> 3) & 7];
+        t[0070000 | i] = mul[(i >> 3) & 7];
+        t[0071000 | i] = div[(i >> 3) & 7];
+        t[0072000 | i] = ash[(i >> 3) & 7];
+        t[0073000 | i] = ashc[(i >> 3) & 7];
+        t[0074000 | i] = xor_[(i >> 3) & 7];
+        t[0077000 | i] = &KB11::SOB;
+    }
+    for (auto i = 0; i < 010000; i++) {
+        const auto m = ((i >> 6) & 070) | ((i >> 3) & 7);
+        for (auto b = 0; b < 2; b++) {
+            for (auto op = 1; op < 7; op++) {
+                t[(b << 15) | (op << 12) | i] = dop[b][op - 1][m];
+            }
         }
     }
-    if (i >= itab.size()) {
-        printf("interrupt table full\n");
+    t[0170011] = &KB11::SETD;
+    return t;
+}
+
+constexpr std::array<KB11::handler, 65536> KB11::dispatch = maketable();
+
+void KB11::interrupt(const uint8_t vec, const uint8_t pri) {
+    if (vec & 3) {
+        printf("Thou darst calling interrupt() with vector %03o?\n", vec);
         std::abort();
     }
-    for (uint8_t j = i + 1; j < itab.size(); j++) {
-        itab[j] = itab[j - 1];
-    }
-    itab[i].vec = vec;
-    itab[i].pri = pri;
+    // the request is visible before its level, see popirq.
+    irqs[pri & 7].fetch_or(uint64_t(1) << (vec >> 2));
+    levels.fetch_or(1 << (pri & 7));
 }
 
-// pop the top interrupt off the itab.
-void KB11::popirq() {
-    for (uint8_t i = 0; i < itab.size() - 1; i++) {
-        itab[i] = itab[i + 1];
+void KB11::popirq(const intr i) {
+    const auto pri = i.pri & 7;
+    if ((irqs[pri].fetch_and(~(uint64_t(1) << (i.vec >> 2))) &
+         ~(uint64_t(1) << (i.vec >> 2))) == 0) {
+        levels.fetch_and(~(1 << pri));
+        // a request posted while the level was being cleared.
+        if (irqs[pri].load()) {
+            levels.fetch_or(1 << pri);
+        }
     }
-    itab[itab.size() - 1].vec = 0;
-    itab[itab.size() - 1].pri = 0;
 }
 
 void KB11::trapat(uint16_t vec) {
@@ -748,6 +876,7 @@ void KB11::trapat(uint16_t vec) {
     // printf("trap: vec: %03o\n", vec);
     //  if (vec == 0220) print = true;
 
+    flags();
     const auto psw = PSW;
     kernelmode();
     push(psw);
@@ -765,6 +894,42 @@ void KB11::printstate() {
            currentmode() ? "U" : "K", N() ? "N" : " ", Z() ? "Z" : " ",
            V() ? "V" : " ", C() ? "C" : " ");
     printf("]  instr %06o: %06o\t ", PC, read16(PC));
-    disasm(PC);
+    disasm(unibus, PC);
     printf("\n");
 }
+
+void KB11::snapshot(Snapshot &s) {
+    // PSW must hold the condition codes, and a WAIT is taken again.
+    flags();
+    auto regs = R;
+    if (waiting && !s.restoring) {
+        regs[7] -= 2;
+    }
+    s.field(regs);
+    if (s.restoring) {
+        R = regs;
+    }
+    s.field(PSW);
+    s.field(stacklimit);
+    s.field(switchregister);
+    s.field(displayregister);
+    s.field(stackpointer);
+    for (auto &q : irqs) {
+        uint64_t v = q.load();
+        s.field(v);
+        if (s.restoring) {
+            q.store(v);
+        }
+    }
+    uint8_t l = levels.load();
+    s.field(l);
+    if (s.restoring) {
+        levels.store(l);
+    }
+    mmu.snapshot(s);
+    unibus.snapshot(s);
+    if (s.restoring) {
+        // the translated blocks came from the core replaced.
+        flush();
+    }
+}
@@ -2,7 +2,10 @@
 #include "kt11.h"
 #include "unibus.h"
 #include <array>
+#include <atomic>
 #include <stdint.h>
+#include <utility>
+#include <vector>
 
 enum { FLAGN = 8, FLAGZ = 4, FLAGV = 2, FLAGC = 1 };
 
@@ -11,12 +14,52 @@ class KB11 {
     void step();
     void reset();
 
+    // stepblock executes the translated basic block at PC. Blocks are
+    // translated once their start has been reached often enough, until
+    // then, and for code in the I/O page, it falls back to step. It returns
+    // the number of instructions executed.
+    uint8_t stepblock();
+
+    // invalidate must be called when the core word at physical address a is
+    // written, it discards the translated blocks if a holds an instruction.
+    inline void invalidate(const uint32_t a) {
+        if (code[a >> 6] == epoch) {
+            flush();
+        }
+    }
+
+    // invalidate must be called when the n bytes of core from physical
+    // address a are written other than by write16, such as by DMA.
+    inline void invalidate(const uint32_t a, const uint32_t n) {
+        for (auto c = a >> 6; c <= (a + n - 1) >> 6; c++) {
+            if (code[c] == epoch) {
+                flush();
+                return;
+            }
+        }
+    }
+
+    // flush discards all translated blocks.
+    void flush();
+
     void trapat(uint16_t vec);
 
-    // interrupt schedules an interrupt.
+    // interrupt requests an interrupt through vec at priority pri. It is
+    // lock free, so safe to call from signal handlers and other threads.
+    // A request already pending is not queued twice.
     void interrupt(uint8_t vec, uint8_t pri);
     void printstate();
 
+    // snapshot carries the whole machine to or from s. It must run between
+    // instructions.
+    void snapshot(Snapshot &s);
+
+    // pc returns the address of the next instruction.
+    inline uint16_t pc() const { return R[7]; }
+
+    // display returns the console display register.
+    inline uint16_t display() const { return displayregister; }
+
     // mode returns the current cpu mode.
     // 0: kernel, 1: supervisor, 2: illegal, 3: user
     constexpr inline uint16_t currentmode() { return (PSW >> 14); }
@@ -28,33 +71,175 @@ class KB11 {
     // returns the current CPU interrupt priority.
     constexpr inline uint16_t priority() { return ((PSW >> 5) & 7); }
 
-    // pop the top interrupt off the itab.
-    void popirq();
-
     struct intr {
         uint8_t vec;
         uint8_t pri;
     };
 
-    std::array<intr, 8> itab;
+    // irq returns the highest priority interrupt request which can be
+    // taken at the current processor priority, the lowest vector first
+    // within a level. Its vec is 0 if there is none.
+    inline intr irq() {
+        const uint8_t l = levels.load(std::memory_order_relaxed);
+        if (l == 0) {
+            return {0, 0};
+        }
+        const uint8_t pri = 31 - __builtin_clz(l);
+        if (pri < priority()) {
+            return {0, 0};
+        }
+        const auto v = irqs[pri].load(std::memory_order_relaxed);
+        if (v == 0) {
+            return {0, 0};
+        }
+        return {uint8_t(__builtin_ctzll(v) << 2), pri};
+    }
+
+    // popirq clears a request returned by irq once it has been taken.
+    void popirq(intr i);
 
-    KT11 mmu;
-    UNIBUS unibus;
+    // unibus is declared ahead of mmu, which maps onto its core.
+    UNIBUS unibus{*this};
+    KT11 mmu{unibus};
 
   private:
-    std::array<uint16_t, 8> R; // R0-R7
-    uint16_t PC;               // holds R[7] during instruction execution
-    uint16_t PSW;              // processor status word
-    uint16_t stacklimit, switchregister, displayregister;
+    // irqs holds a bit for each pending vector (vec >> 2) at each priority
+    // level, levels a bit for each level with a request pending.
+    std::array<std::atomic<uint64_t>, 8> irqs{};
+    std::atomic<uint8_t> levels{};
+
+    std::array<uint16_t, 8> R{}; // R0-R7
+    uint16_t PC{};               // holds R[7] during instruction execution
+    uint16_t PSW{};              // processor status word
+    uint16_t stacklimit{}, switchregister{}, displayregister{};
     std::array<uint16_t, 4>
-        stackpointer; // Alternate R6 (kernel, super, illegal, user)
+        stackpointer{}; // Alternate R6 (kernel, super, illegal, user)
+
+    // waiting is set while WAIT idles, a snapshot taken then resumes at
+    // the WAIT.
+    bool waiting = false;
+
+    bool print{};
+
+    using handler = void (KB11::*)(const uint16_t instr);
+
+    // A translated basic block, keyed by the physical address of its first
+    // instruction and the cpu mode. A block never crosses a 64 byte
+    // boundary so the KT11 checks made fetching its first instruction
+    // cover the rest. Each op records the instruction's length in words,
+    // any other change to the PC leaves the block.
+    struct block {
+        uint32_t pa;
+        uint32_t epoch;
+        uint16_t mode;
+        uint8_t heat;
+        uint8_t len;
+        struct op {
+            handler fn;
+            uint16_t instr;
+            uint8_t len;
+        };
+        std::array<op, 16> ops;
+    };
 
-    bool print;
+    std::vector<block> blocks;
+
+    // endblock is set by I/O page accesses and flushes to return to the
+    // interpreter once the current instruction completes.
+    bool endblock{};
+
+    // epoch is advanced by flush, blocks and code marks from earlier
+    // epochs are stale.
+    uint32_t epoch = 1;
+
+    // code holds the epoch in which each 64 byte chunk of core last had
+    // an instruction translated from it.
+    std::array<uint32_t, (IOBASE_18BIT >> 6)> code{};
+
+    void translate(block &b, uint32_t a);
+    static uint8_t length(uint16_t instr);
+
+    // dispatch holds the handler for every opcode, each instantiated for
+    // the operand size and addressing modes encoded in that opcode.
+    static const std::array<handler, 65536> dispatch;
+    static constexpr std::array<handler, 65536> maketable();
+
+    // dd returns f's handler for each destination mode.
+    template <typename F> static constexpr std::array<handler, 8> dd(F f) {
+        return modes(f, std::make_index_sequence<8>());
+    }
+
+    // ssdd returns f's handler for each source and destination mode pair,
+    // indexed by (source mode << 3) | destination mode.
+    template <typename F> static constexpr std::array<handler, 64> ssdd(F f) {
+        return modes(f, std::make_index_sequence<64>());
+    }
+
+    template <typename F, size_t... I>
+    static constexpr std::array<handler, sizeof...(I)>
+    modes(F f, std::index_sequence<I...>) {
+        if constexpr (sizeof...(I) == 8) {
+            return {f(std::integral_constant<int, I>())...};
+        } else {
+            return {f(std::integral_constant<int, (I >> 3)>(),
+                      std::integral_constant<int, (I & 7)>())...};
+        }
+    }
+
+    // Condition codes are evaluated lazily. The common handlers record
+    // their result and operands in cc rather than computing N, Z, V & C,
+    // the flags are folded into PSW by flags when they are next read.
+    // Handlers which update PSW directly must call flags first.
+    enum : uint8_t {
+        CCPSW, // PSW holds the condition codes
+        CCNZ,  // setNZ, C from PSW
+        CCNZV, // setNZV, C from PSW
+        CCTST, // N & Z from res, V & C clear
+        CCCMP, // CMP src, dst
+        CCADD, // ADD src, dst giving res
+        CCSUB  // SUB src from dst giving res
+    };
+
+    struct {
+        uint8_t op;
+        uint8_t len;
+        uint16_t res, src, dst;
+    } cc{};
+
+    inline void flags() {
+        if (cc.op != CCPSW) {
+            settle();
+        }
+    }
+    void settle();
+
+    template <auto len>
+    inline void lazy(const uint8_t op, const uint16_t res,
+                     const uint16_t src = 0, const uint16_t dst = 0) {
+        static_assert(len == 1 || len == 2);
+        cc.op = op;
+        cc.len = len;
+        cc.res = res;
+        cc.src = src;
+        cc.dst = dst;
+    }
 
-    inline bool N() { return PSW & FLAGN; }
-    inline bool Z() { return PSW & FLAGZ; }
-    inline bool V() { return PSW & FLAGV; }
-    inline bool C() { return PSW & FLAGC; }
+    inline bool N() {
+        flags();
+        return PSW & FLAGN;
+    }
+    inline bool Z() {
+        flags();
+        return PSW & FLAGZ;
+    }
+    inline bool V() {
+        flags();
+        return PSW & FLAGV;
+    }
+    inline bool C() {
+        flags();
+        return PSW & FLAGC;
+    }
     inline void setZ(const bool b) {
         if (b)
             PSW |= FLAGZ;
@@ -80,58 +265,58 @@ class KB11 {
         return val;
     }
 
-    template <auto len> inline uint16_t DA(const uint16_t instr) {
+    template <auto len, auto mode> inline uint16_t DA(const uint16_t instr) {
         static_assert(len == 1 || len == 2);
-        if (!(instr & 070)) {
+        if constexpr (mode == 0) {
             return 0170000 | (instr & 7);
         }
-        return fetchOperand<len>(instr);
+        return fetchOperand<len, mode>(instr & 7);
     }
 
-    template <auto len> uint16_t fetchOperand(const uint16_t instr) {
-        const auto mode = (instr >> 3) & 7;
-        const auto reg = instr & 7;
-
+    template <auto len, auto mode>
+    inline uint16_t fetchOperand(const uint16_t reg) {
+        static_assert(mode >= 0 && mode <= 7);
         uint16_t addr;
-        switch (mode) {
-        case 0: // Mode 0: Registers don't have a virtual address so trap!
+        if constexpr (mode == 0) {
+            // Mode 0: Registers don't have a virtual address so trap!
             trap(4);
-        case 1: // Mode 1: (R)
+        } else if constexpr (mode == 1) { // Mode 1: (R)
             return R[reg];
-        case 2: // Mode 2: (R)+ including immediate operand #x
+        } else if constexpr (mode == 2) {
+            // Mode 2: (R)+ including immediate operand #x
             addr = R[reg];
             R[reg] += (reg >= 6) ? 2 : len;
             return addr;
-        case 3: // Mode 3: @(R)+
+        } else if constexpr (mode == 3) { // Mode 3: @(R)+
             addr = R[reg];
             R[reg] += 2;
             return read16(addr);
-        case 4: // Mode 4: -(R)
+        } else if constexpr (mode == 4) { // Mode 4: -(R)
             R[reg] -= (reg >= 6) ? 2 : len;
             addr = R[reg];
             return addr;
-        case 5: // Mode 5: @-(R)
+        } else if constexpr (mode == 5) { // Mode 5: @-(R)
             R[reg] -= 2;
             addr = R[reg];
             return read16(addr);
-        case 6: // Mode 6: d(R)
+        } else if constexpr (mode == 6) { // Mode 6: d(R)
             addr = fetch16();
             addr = addr + R[reg];
             return addr;
-        default: // 7 Mode 7: @d(R)
+        } else { // Mode 7: @d(R)
             addr = fetch16();
             addr = addr + R[reg];
             return read16(addr);
         }
     }
 
-    template <auto len> constexpr uint16_t SS(const uint16_t instr) {
+    template <auto len, auto mode> inline uint16_t SS(const uint16_t instr) {
         static_assert(len == 1 || len == 2);
-        if (!((instr >> 6) & 070)) {
+        if constexpr (mode == 0) {
             // If register mode just get register value
             return R[(instr >> 6) & 7] & max<len>();
         }
-        const auto addr = fetchOperand<len>(instr >> 6);
+        const auto addr = fetchOperand<len, mode>((instr >> 6) & 7);
         if constexpr (len == 2) {
             return read16(addr);
         }
@@ -150,6 +335,7 @@ class KB11 {
     }
 
     constexpr inline void writePSW(const uint16_t psw) {
+        cc.op = CCPSW;
         stackpointer[currentmode()] = R[6];
         PSW = psw;
         R[6] = stackpointer[currentmode()];
@@ -160,9 +346,10 @@ class KB11 {
         writePSW((PSW & 0007777) | (currentmode() << 12));
     }
 
-    template <auto l> constexpr inline uint16_t read(const uint16_t a) {
+    template <auto l, auto mode>
+    constexpr inline uint16_t read(const uint16_t a) {
         static_assert(l == 1 || l == 2);
-        if ((a & 0177770) == 0170000) {
+        if constexpr (mode == 0) {
             if constexpr (l == 2) {
                 return R[a & 7];
             } else {
@@ -178,9 +365,10 @@ class KB11 {
         return read16(a) & 0xFF;
     }
 
-    template <auto l> constexpr void write(const uint16_t a, const uint16_t v) {
+    template <auto l, auto mode>
+    constexpr void write(const uint16_t a, const uint16_t v) {
         static_assert(l == 1 || l == 2);
-        if ((a & 0177770) == 0170000) {
+        if constexpr (mode == 0) {
             auto r = a & 7;
             if constexpr (l == 2) {
                 R[r] = v;
@@ -220,49 +408,38 @@ class KB11 {
     }
 
     // CMP 02SSDD, CMPB 12SSDD
-    template <auto l> void CMP(const uint16_t instr) {
-        const auto src = SS<l>(instr);
-        const auto da = DA<l>(instr);
-        const auto dst = read<l>(da);
-        const auto sval = (src - dst) & max<l>();
-        PSW &= 0xFFF0;
-        if (sval == 0) {
-            PSW |= FLAGZ;
-        }
-        if (sval & msb<l>()) {
-            PSW |= FLAGN;
-        }
-        if (((src ^ dst) & msb<l>()) && (!((dst ^ sval) & msb<l>()))) {
-            PSW |= FLAGV;
-        }
-        if (src < dst) {
-            PSW |= FLAGC;
-        }
+    template <auto l, auto s, auto d> void CMP(const uint16_t instr) {
+        const auto src = SS<l, s>(instr);
+        const auto da = DA<l, d>(instr);
+        const auto dst = read<l, d>(da);
+        lazy<l>(CCCMP, 0, src, dst);
     }
 
     // Set N & Z clearing V (C unchanged)
     template <auto len> inline void setNZ(const uint16_t v) {
-        static_assert(len == 1 || len == 2);
-        PSW &= (0xFFF0 | FLAGC);
-        if (v & msb<len>()) {
-            PSW |= FLAGN;
-        }
-        if ((v & max<len>()) == 0) {
-            PSW |= FLAGZ;
+        if (cc.op > CCNZV) {
+            flags(); // C comes from the pending operation
         }
+        lazy<len>(CCNZ, v);
     }
 
     // Set N, Z & V (C unchanged)
     template <auto len> inline void setNZV(const uint16_t v) {
-        setNZ<len>(v);
-        if (v == msb<len>()) {
-            PSW |= FLAGV;
+        if (cc.op > CCNZV) {
+            flags();
         }
+        lazy<len>(CCNZV, v);
+    }
+
+    // Set N & Z clearing V & C
+    template <auto len> inline void setNZclrC(const uint16_t v) {
+        lazy<len>(CCTST, v);
     }
 
     // Set N, Z & C clearing V
     template <auto len> inline void setNZC(const uint16_t v) {
         static_assert(len == 1 || len == 2);
+        flags();
         PSW &= 0xFFF0;
         if (v & msb<len>()) {
             PSW |= FLAGN;
@@ -273,44 +450,36 @@ class KB11 {
         PSW |= FLAGC;
     }
 
-    template <auto l> void BIC(const uint16_t instr) {
-        const auto src = SS<l>(instr);
-        const auto da = DA<l>(instr);
-        const auto dst = read<l>(da);
+    template <auto l, auto s, auto d> void BIC(const uint16_t instr) {
+        const auto src = SS<l, s>(instr);
+        const auto da = DA<l, d>(instr);
+        const auto dst = read<l, d>(da);
         auto uval = (max<l>() ^ src) & dst;
-        write<l>(da, uval);
-        PSW &= 0xFFF1;
-        setZ(uval == 0);
-        if (uval & msb<l>()) {
-            PSW |= FLAGN;
-        }
+        write<l, d>(da, uval);
+        setNZ<l>(uval);
     }
 
-    template <auto l> void BIS(const uint16_t instr) {
-        const auto src = SS<l>(instr);
-        const auto da = DA<l>(instr);
-        const auto dst = read<l>(da);
+    template <auto l, auto s, auto d> void BIS(const uint16_t instr) {
+        const auto src = SS<l, s>(instr);
+        const auto da = DA<l, d>(instr);
+        const auto dst = read<l, d>(da);
         auto uval = src | dst;
-        write<l>(da, uval);
-        PSW &= 0xFFF1;
-        setZ(uval == 0);
-        if (uval & msb<l>()) {
-            PSW |= FLAGN;
-        }
+        write<l, d>(da, uval);
+        setNZ<l>(uval);
     }
 
     // CLR 0050DD, CLRB 1050DD
-    template <auto l> void CLR(const uint16_t instr) {
-        write<l>(DA<l>(instr), 0);
-        PSW &= 0xFFF0;
-        PSW |= FLAGZ;
+    template <auto l, auto d> void CLR(const uint16_t instr) {
+        write<l, d>(DA<l, d>(instr), 0);
+        setNZclrC<l>(0);
     }
 
     // COM 0051DD, COMB 1051DD
-    template <auto l> void COM(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto dst = ~read<l>(da);
-        write<l>(da, dst);
+    template <auto l, auto d> void COM(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        const auto dst = ~read<l, d>(da);
+        write<l, d>(da, dst);
         PSW &= 0xFFF0;
         if ((dst & msb<l>()) == 0) {
             PSW |= FLAGN;
@@ -322,18 +491,19 @@ class KB11 {
     }
 
     // DEC 0053DD, DECB 1053DD
-    template <auto l> void _DEC(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto uval = (read<l>(da) - 1) & max<l>();
-        write<l>(da, uval);
+    template <auto l, auto d> void _DEC(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        const auto uval = (read<l, d>(da) - 1) & max<l>();
+        write<l, d>(da, uval);
         setNZV<l>(uval);
     }
 
     // NEG 0054DD, NEGB 1054DD
-    template <auto l> void NEG(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto dst = (-read<l>(da)) & max<l>();
-        write<l>(da, dst);
+    template <auto l, auto d> void NEG(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        const auto dst = (-read<l, d>(da)) & max<l>();
+        write<l, d>(da, dst);
         PSW &= 0xFFF0;
         if (dst & msb<l>()) {
             PSW |= FLAGN;
@@ -348,11 +518,12 @@ class KB11 {
         }
     }
 
-    template <auto l> void _ADC(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto uval = read<l>(da);
+    template <auto l, auto d> void _ADC(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        const auto uval = read<l, d>(da);
         if (PSW & FLAGC) {
-            write<l>(da, (uval + 1) & max<l>());
+            write<l, d>(da, (uval + 1) & max<l>());
             PSW &= 0xFFF0;
             if ((uval + 1) & msb<l>()) {
                 PSW |= FLAGN;
@@ -373,11 +544,12 @@ class KB11 {
         }
     }
 
-    template <auto l> void SBC(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto sval = read<l>(da);
+    template <auto l, auto d> void SBC(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        const auto sval = read<l, d>(da);
         if (C()) {
-            write<l>(da, (sval - 1) & max<l>());
+            write<l, d>(da, (sval - 1) & max<l>());
             PSW &= 0xFFF0;
             if ((sval - 1) & msb<l>()) {
                 PSW |= FLAGN;
@@ -402,14 +574,15 @@ class KB11 {
         }
     }
 
-    template <auto l> void ROR(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto dst = read<l>(da);
+    template <auto l, auto d> void ROR(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        const auto dst = read<l, d>(da);
         auto result = dst >> 1;
         if (PSW & FLAGC) {
             result |= max<l>() + 1;
         }
-        write<l>(da, result);
+        write<l, d>(da, result);
         PSW &= 0xFFF0;
         if ((dst & 1) > 0) {
             // shift lsb into carry
@@ -426,9 +599,10 @@ class KB11 {
         }
     }
 
-    template <auto l> void ROL(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        int32_t sval = read<l>(da) << 1;
+    template <auto l, auto d> void ROL(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        int32_t sval = read<l, d>(da) << 1;
         if (PSW & FLAGC) {
             sval |= 1;
         }
@@ -444,12 +618,13 @@ class KB11 {
             PSW |= FLAGV;
         }
         sval &= max<l>();
-        write<l>(da, sval);
+        write<l, d>(da, sval);
     }
 
-    template <auto l> void ASR(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        auto uval = read<l>(da);
+    template <auto l, auto d> void ASR(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
+        auto uval = read<l, d>(da);
         PSW &= 0xFFF0;
         if (uval & 1) {
             PSW |= FLAGC;
@@ -462,13 +637,14 @@ class KB11 {
         }
         uval = (uval & msb<l>()) | (uval >> 1);
         setZ(uval == 0);
-        write<l>(da, uval);
+        write<l, d>(da, uval);
     }
 
-    template <auto l> void ASL(const uint16_t instr) {
-        const auto da = DA<l>(instr);
+    template <auto l, auto d> void ASL(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        flags();
         // TODO(dfc) doesn't need to be an sval
-        int32_t sval = read<l>(da);
+        int32_t sval = read<l, d>(da);
         PSW &= 0xFFF0;
         if (sval & msb<l>()) {
             PSW |= FLAGC;
@@ -481,69 +657,88 @@ class KB11 {
         }
         sval = (sval << 1) & max<l>();
         setZ(sval == 0);
-        write<l>(da, sval);
+        write<l, d>(da, sval);
     }
 
     // INC 0052DD, INCB 1052DD
-    template <auto l> void INC(const uint16_t instr) {
-        const auto da = DA<l>(instr);
-        const auto dst = read<l>(da) + 1;
-        write<l>(da, dst);
+    template <auto l, auto d> void INC(const uint16_t instr) {
+        const auto da = DA<l, d>(instr);
+        const auto dst = read<l, d>(da) + 1;
+        write<l, d>(da, dst);
         setNZV<l>(dst);
     }
 
     // BIT 03SSDD, BITB 13SSDD
-    template <auto l> void BIT(const uint16_t instr) {
-        const auto src = SS<l>(instr);
-        const auto dst = read<l>(DA<l>(instr));
+    template <auto l, auto s, auto d> void BIT(const uint16_t instr) {
+        const auto src = SS<l, s>(instr);
+        const auto dst = read<l, d>(DA<l, d>(instr));
         const auto result = src & dst;
         setNZ<l>(result);
     }
 
     // TST 0057DD, TSTB 1057DD
-    template <auto l> void TST(const uint16_t instr) {
-        const auto dst = read<l>(DA<l>(instr));
-        PSW &= 0xFFF0;
-        if ((dst & max<l>()) == 0) {
-            PSW |= FLAGZ;
-        }
-        if (dst & msb<l>()) {
-            PSW |= FLAGN;
-        }
+    template <auto l, auto d> void TST(const uint16_t instr) {
+        const auto dst = read<l, d>(DA<l, d>(instr));
+        setNZclrC<l>(dst);
     }
 
     // MOV 01SSDD, MOVB 11SSDD
-    template <auto len> void MOV(const uint16_t instr) {
-        const auto src = SS<len>(instr);
-        if (!(instr & 0x38) && (len == 1)) {
+    template <auto len, auto s, auto d> void MOV(const uint16_t instr) {
+        const auto src = SS<len, s>(instr);
+        if constexpr (d == 0 && len == 1) {
             // Special case: movb sign extends register to word size
             R[instr & 7] = src & 0x80 ? 0xff00 | src : src;
             setNZ<len>(src);
             return;
         }
-        write<len>(DA<len>(instr), src);
+        write<len, d>(DA<len, d>(instr), src);
         setNZ<len>(src);
     }
 
-    void ADD(const uint16_t instr);
-    void SUB(const uint16_t instr);
-    void JSR(const uint16_t instr);
-    void MUL(const uint16_t instr);
-    void DIV(const uint16_t instr);
-    void ASH(const uint16_t instr);
-    void ASHC(const uint16_t instr);
-    void XOR(const uint16_t instr);
+    template <auto s, auto d> void ADD(const uint16_t instr);
+    template <auto s, auto d> void SUB(const uint16_t instr);
+    template <auto d> void JSR(const uint16_t instr);
+    template <auto d> void MUL(const uint16_t instr);
+    template <auto d> void DIV(const uint16_t instr);
+    template <auto d> void ASH(const uint16_t instr);
+    template <auto d> void ASHC(const uint16_t instr);
+    template <auto d> void XOR(const uint16_t instr);
     void SOB(const uint16_t instr);
-    void JMP(const uint16_t instr);
+    template <auto d> void JMP(const uint16_t instr);
     void MARK(const uint16_t instr);
-    void MFPI(const uint16_t instr);
-    void MFPT();
-    void MTPI(const uint16_t instr);
+    template <auto d> void MFPI(const uint16_t instr);
+    void MFPT(const uint16_t);
+    template <auto d> void MTPI(const uint16_t instr);
     void RTS(const uint16_t instr);
     void EMTX(const uint16_t instr);
-    void SWAB(uint16_t);
-    void SXT(uint16_t);
-    void RTT();
-    void RESET();
-    void WAIT();
+    template <auto d> void SWAB(const uint16_t instr);
+    template <auto d> void SXT(const uint16_t instr);
+    void RTT(const uint16_t);
+    void RESET(const uint16_t);
+    void WAIT(const uint16_t);
+    void HALT(const uint16_t);
+    void BPT(const uint16_t);
+    void IOT(const uint16_t);
+    void EMT(const uint16_t);
+    void TRAP(const uint16_t);
+    void SPL(const uint16_t instr);
+    void CCC(const uint16_t instr);
+    void SCC(const uint16_t instr);
+    void SETD(const uint16_t);
+    void INVAL(const uint16_t instr);
+    void BR(const uint16_t instr);
+    void BNE(const uint16_t instr);
+    void BEQ(const uint16_t instr);
+    void BGE(const uint16_t instr);
+    void BLT(const uint16_t instr);
+    void BGT(const uint16_t instr);
+    void BLE(const uint16_t instr);
+    void BPL(const uint16_t instr);
+    void BMI(const uint16_t instr);
+    void BHI(const uint16_t instr);
+    void BLOS(const uint16_t instr);
+    void BVC(const uint16_t instr);
+    void BVS(const uint16_t instr);
+    void BCC(const uint16_t instr);
+    void BCS(const uint16_t instr);
 };
\ No newline at end of file
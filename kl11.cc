@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cstdlib>
+#include <errno.h>
 #include <fcntl.h>
-#include <signal.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -8,31 +10,33 @@
 #include "kb11.h"
 #include "kl11.h"
 
-extern KB11 cpu;
-
-bool keypressed = false;
-
-static void sigioHandler(int) { keypressed = true; }
-
-KL11::KL11() {
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sa.sa_handler = sigioHandler;
-    if (sigaction(SIGIO, &sa, NULL) == -1)
-        perror("sigaction");
-
-    /* Set owner process that is to receive "I/O possible" signal */
+KL11::KL11(UNIBUS &bus) : bus(bus), writer(bus.sched, EVTTYWRITE) {
+    bus.attach(*this, 0777560, 0777570);
+}
 
-    if (fcntl(STDIN_FILENO, F_SETOWN, getpid()) == -1)
-        perror("fcntl(F_SETOWN)");
+void KL11::connect(const int i, const int o) {
+    in = i;
+    out = o;
+    auto flags = fcntl(in, F_GETFL);
+    if ((flags == -1) || (fcntl(in, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        perror("fcntl(F_SETFL)");
+    }
+    // whatever runs the machine reports input as it arrives, but regular
+    // files are never reported ready, look for input straight away.
+    rxready();
+}
 
-    /* Enable "I/O possible" signaling and make I/O nonblocking
-       for file descriptor */
+void KL11::forked() {
+    writer.forked();
+    writing = false;
+    keypressed = false;
+    eof = false;
+    connect(in, out);
+}
 
-    auto flags = fcntl(STDIN_FILENO, F_GETFL);
-    if (fcntl(STDIN_FILENO, F_SETFL, flags | O_ASYNC | O_NONBLOCK) == -1)
-        perror("fcntl(F_SETFL)");
+void KL11::rxready() {
+    keypressed = true;
+    bus.sched.signal(EVTTYIN);
 }
 
 void KL11::clearterminal() {
@@ -40,55 +44,124 @@ void KL11::clearterminal() {
     xcsr = 0x80;
     rbuf = 0;
     xbuf = 0;
-    count = 0;
-}
-
-int getchar() {
-    char ch;
-    while (read(STDIN_FILENO, &ch, 1) > 0) {
-        printf("read %06o\n", ch);
-        break;
-    }
-    return ch;
 }
 
 void KL11::poll() {
     if (!rcvrdone()) {
-        // unit not busy
-        if (keypressed) {
+        // unit not busy. The flag is cleared before the read, so input
+        // the host reports meanwhile sets it again rather than being lost.
+        if (keypressed.exchange(false)) {
             char ch;
-            if (read(STDIN_FILENO, &ch, 1) > 0) {
+            const auto n = read(in, &ch, 1);
+            if (n > 0) {
+                // there may be more.
+                keypressed = true;
                 rbuf = ch & 0x7f;
                 rcsr |= 0x80;
                 if (rcsr & 0x40) {
-                    cpu.interrupt(INTTTYIN, 4);
+                    bus.cpu.interrupt(INTTTYIN, 4);
                 }
             } else {
-                keypressed = false;
+                eof = n == 0;
             }
         }
     }
+}
 
+void KL11::xmit() {
     if (xbuf) {
-        write(STDERR_FILENO, &xbuf, 1);
-	xbuf = 0;
-        count = 32;
+        const auto h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == ring.size()) {
+            // the host has fallen behind, hold the character until the
+            // writer has made room. A write is in flight, so written will
+            // run.
+            full = true;
+            return;
+        }
+        ring[h & (ring.size() - 1)] = xbuf;
+        head.store(h + 1, std::memory_order_release);
+        if (!writing) {
+            writing = true;
+            writer.submit([this] { writeout(); });
+        }
+        if (watch) {
+            watch(xbuf);
+        }
+        xbuf = 0;
+        if (latency) {
+            bus.sched.at(EVTTYOUT, latency);
+            return;
+        }
     }
-
-    if (!xmitready() && (--count == 0)) {
+    if (!xmitready()) {
         xcsr |= 0x80;
         if (xcsr & 0x40) {
-            cpu.interrupt(INTTTYOUT, 4);
+            bus.cpu.interrupt(INTTTYOUT, 4);
         }
     }
 }
 
+void KL11::writeout() {
+    auto t = tail.load(std::memory_order_relaxed);
+    uint32_t h;
+    while ((h = head.load(std::memory_order_acquire)) != t) {
+        // up to the end of the ring, or head, at once.
+        const auto i = t & (ring.size() - 1);
+        const auto n =
+            write(out, &ring[i], std::min<size_t>(h - t, ring.size() - i));
+        if ((n == -1) && (errno == EAGAIN)) {
+            // out shares the non blocking flag with in on a terminal.
+            struct pollfd p = {out, POLLOUT, 0};
+            ::poll(&p, 1, -1);
+            continue;
+        }
+        if ((n == -1) && (errno == EINTR)) {
+            continue;
+        }
+        // the rest is lost if out can't be written.
+        t = n > 0 ? t + n : h;
+        tail.store(t, std::memory_order_release);
+    }
+}
+
+void KL11::room() {
+    if (full) {
+        full = false;
+        bus.sched.at(EVTTYOUT, 1);
+    }
+}
+
+void KL11::written() {
+    if (!writer.finished()) {
+        return;
+    }
+    writing = false;
+    room();
+    if (head.load(std::memory_order_relaxed) !=
+        tail.load(std::memory_order_acquire)) {
+        // transmitted after the writer looked.
+        writing = true;
+        writer.submit([this] { writeout(); });
+    }
+}
+
+void KL11::flush() {
+    writer.drain();
+    // the writer is idle, this thread may empty the ring itself.
+    writeout();
+    room();
+}
+
 uint16_t KL11::read16(uint32_t a) {
     switch (a) {
     case 0777560:
         return rcsr;
     case 0777562:
         rcsr &= ~0x80;
+        if (keypressed) {
+            // more input may be waiting now the receiver is free.
+            bus.sched.at(EVTTYIN, 1);
+        }
         return rbuf;
     case 0777564:
         return xcsr;
@@ -107,6 +180,9 @@ void KL11::write16(uint32_t a, uint16_t v) {
         break;
     case 0777562:
         rcsr &= ~0x80;
+        if (keypressed) {
+            bus.sched.at(EVTTYIN, 1);
+        }
         break;
     case 0777564:
         // printf("kl11:write16: %06o %06o\n", a, v);
@@ -115,9 +191,23 @@ void KL11::write16(uint32_t a, uint16_t v) {
     case 0777566:
         xbuf = v & 0x7f;
         xcsr &= ~0x80;
+        bus.sched.at(EVTTYOUT, 1);
         break;
     default:
         printf("kl11: write to invalid address %06o\n", a);
         std::abort();
     }
 }
+
+void KL11::snapshot(Snapshot &s) {
+    s.field(rcsr);
+    s.field(rbuf);
+    s.field(xcsr);
+    s.field(xbuf);
+    if (s.restoring && xbuf) {
+        // the character may have been held for want of room, which the
+        // empty ring now has.
+        full = false;
+        bus.sched.at(EVTTYOUT, 1);
+    }
+}
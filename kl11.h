@@ -1,22 +1,90 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <functional>
 #include <stdint.h>
 
+#include "iothread.h"
+
+class Snapshot;
+class UNIBUS;
+
+// KL11 is the console. Characters transmitted go into a ring which a writer
+// thread empties to the host with as few writes as it can, so the guest
+// doesn't wait on the host for each one.
 class KL11 {
 
   public:
-    KL11();
+    explicit KL11(UNIBUS &bus);
+
+    // latency is the number of instructions after a character is taken
+    // before the transmitter is ready for the next, none by default.
+    uint32_t latency = 0;
+
+    // eof is set once input from a file has all been read.
+    bool eof = false;
+
+    // watch, if set, is called with each character transmitted.
+    std::function<void(uint8_t)> watch;
+
+    // connect has the console read from the host fd in and write to out.
+    void connect(int in, int out);
 
     void clearterminal();
+
+    // rxready notes that the console has input waiting. It is safe to call
+    // from a signal handler or another thread.
+    void rxready();
+
+    // poll receives a character if one is waiting and the receiver is free.
     void poll();
+
+    // xmit transmits xbuf, then signals ready after latency instructions.
+    // While the ring is full the transmitter stays busy, until written
+    // finds room for xbuf.
+    void xmit();
+
+    // written runs once the writer thread has emptied the ring.
+    void written();
+
+    // flush writes out everything transmitted, before returning. It must
+    // be called before exiting, or forking.
+    void flush();
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
+    void snapshot(Snapshot &s);
+
+    // forked must run in a clone after fork, once the console's fds have
+    // been replaced, to have input waiting on them noticed. The console
+    // must have been flushed first.
+    void forked();
 
   private:
+    UNIBUS &bus;
+    int in = -1, out = -1;
+
+    // keypressed is set when input may be waiting.
+    std::atomic<bool> keypressed{false};
+
     uint16_t rcsr;
     uint16_t rbuf;
     uint16_t xcsr;
     uint8_t xbuf;
-    uint16_t count;
+
+    // ring holds the characters transmitted and not yet written. The cpu
+    // thread adds them at head, the writer takes them from tail, each
+    // publishing its index only once done with the characters it covers.
+    std::array<uint8_t, 8192> ring;
+    std::atomic<uint32_t> head{0}, tail{0};
+    bool writing = false; // a write job is in flight
+    bool full = false;    // xbuf is held until the ring has room
+    IOThread writer;
+
+    // writeout empties the ring to out.
+    void writeout();
+
+    // room has xmit try xbuf again if it was held for want of room.
+    void room();
 
     inline bool rcvrdone() { return rcsr & 0x80; }
     inline bool xmitready() { return xcsr & 0x80; }
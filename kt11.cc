@@ -1,9 +1,117 @@
+#include "kb11.h"
 #include "kt11.h"
+#include "unibus.h"
 #include <stdint.h>
 #include <stdio.h>
 
+KT11::KT11(UNIBUS &bus) : bus(bus), core(bus.core.data()) {
+    bus.attach(*this, 0772200, 0772400); // supervisor and kernel PDR/PAR
+    bus.attach(*this, 0777572, 0777600); // SR0-SR2
+    bus.attach(*this, 0777600, 0777700); // user PDR/PAR
+    for (uint16_t mode = 0; mode < 4; mode++) {
+        for (uint8_t i = 0; i < 8; i++) {
+            fill(mode, i);
+        }
+    }
+}
+
+void KT11::fill(const uint16_t mode, const uint8_t i) {
+    auto &t = tlb[mode][i];
+    if ((SR[0] & 1) == 0) {
+        // unmapped, the top of page 7 is the I/O page.
+        const uint16_t len = i < 7 ? 020000 : 0;
+        t = {uint32_t(i) << 13, 0, len, len,
+             len ? core + (i << 12) : nullptr};
+        return;
+    }
+    auto &p = pages[mode][i];
+    t.base = p.addr() << 6;
+    t.lo = p.ed() ? p.len() << 6 : 0;
+    const uint16_t len = (p.ed() ? 020000 : (p.len() + 1) << 6) - t.lo;
+    t.rlen = p.read() ? len : 0;
+    t.wlen = (p.read() && p.write() && (p.pdr & (1 << 6))) ? len : 0;
+    t.ram = (t.base + 020000 <= IOBASE_18BIT) ? core + (t.base >> 1) : nullptr;
+}
+
+void KT11::writeSR0(const uint16_t v) {
+    const auto enable = (SR[0] ^ v) & 1;
+    SR[0] = v;
+    if (enable) {
+        for (uint16_t mode = 0; mode < 4; mode++) {
+            for (uint8_t i = 0; i < 8; i++) {
+                fill(mode, i);
+            }
+        }
+    }
+}
+
+template <bool wr>
+uint32_t KT11::translate(const uint16_t a, const uint16_t mode) {
+    if ((SR[0] & 1) == 0) {
+        return a > 0167777 ? ((uint32_t)a) + 0600000 : a;
+    }
+    const auto i = (a >> 13);
+    if (wr && !pages[mode][i].write()) {
+        SR[0] = (1 << 13) | 1;
+        SR[0] |= (a >> 12) & ~1;
+        if (mode) {
+            SR[0] |= (1 << 5) | (1 << 6);
+        }
+        // SR2 = cpu.PC;
+
+        printf("mmu::decode write to read-only page %06o\n", a);
+        trap(0250); // intfault
+    }
+    if (!pages[mode][i].read()) {
+        SR[0] = (1 << 15) | 1;
+        SR[0] |= (a >> 12) & ~1;
+        if (mode) {
+            SR[0] |= (1 << 5) | (1 << 6);
+        }
+        // SR2 = cpu.PC;
+        printf("mmu::decode read from no-access page %06o\n", a);
+        trap(0250); // intfault
+    }
+    const auto block = (a >> 6) & 0177;
+    const auto disp = a & 077;
+    // if ((p.ed() && (block < p.len())) || (!p.ed() && (block > p.len())))
+    // {
+    if (pages[mode][i].ed() ? (block < pages[mode][i].len())
+                            : (block > pages[mode][i].len())) {
+        SR[0] = (1 << 14) | 1;
+        SR[0] |= (a >> 12) & ~1;
+        if (mode) {
+            SR[0] |= (1 << 5) | (1 << 6);
+        }
+        // SR2 = cpu.PC;
+        printf("page length exceeded, address %06o (block %03o) is beyond "
+               "length "
+               "%03o\r\n",
+               a, block, pages[mode][i].len());
+        trap(0250); // intfault
+    }
+    if constexpr (wr) {
+        pages[mode][i].pdr |= 1 << 6;
+        fill(mode, i);
+    }
+    const auto aa = ((pages[mode][i].addr() + block) << 6) + disp;
+    // printf("decode: slow %06o -> %06o\n", a, aa);
+    return aa;
+}
+
+template uint32_t KT11::translate<false>(uint16_t a, uint16_t mode);
+template uint32_t KT11::translate<true>(uint16_t a, uint16_t mode);
+
 uint16_t KT11::read16(const uint32_t a) {
     // printf("kt11:read16: %06o\n", a);
+    switch (a) {
+    case 0777572:
+        return SR[0];
+    case 0777574:
+        return SR[1];
+    case 0777576:
+        return SR[2];
+    }
     const auto i = ((a & 017) >> 1);
     switch (a & ~037) {
     case 0772200:
@@ -26,6 +134,18 @@ uint16_t KT11::read16(const uint32_t a) {
 
 void KT11::write16(const uint32_t a, const uint16_t v) {
     //  printf("kt11:write16: %06o %06o\n", a, v);
+    switch (a) {
+    case 0777572:
+        writeSR0(v);
+        bus.cpu.flush();
+        return;
+    case 0777574:
+        SR[1] = v;
+        return;
+    case 0777576:
+        // do nothing, SR2 is read only
+        return;
+    }
     const auto i = ((a & 017) >> 1);
     switch (a & ~037) {
     case 0772200:
@@ -50,4 +170,20 @@ void KT11::write16(const uint32_t a, const uint16_t v) {
         printf("mmu::write16 write to invalid address %06o\n", a);
         trap(004); // intbus
     }
+    for (uint16_t mode = 0; mode < 4; mode++) {
+        fill(mode, i);
+    }
+    bus.cpu.flush();
+}
+
+void KT11::snapshot(Snapshot &s) {
+    s.field(SR);
+    s.field(pages);
+    if (s.restoring) {
+        for (uint16_t mode = 0; mode < 4; mode++) {
+            for (uint8_t i = 0; i < 8; i++) {
+                fill(mode, i);
+            }
+        }
+    }
 }
@@ -2,69 +2,55 @@
 #include "avr11.h"
 #include <array>
 #include <stdint.h>
+#include <stdio.h>
+
+class Snapshot;
+class UNIBUS;
 
 class KT11 {
 
   public:
-    std::array<uint16_t, 4> SR;
+    std::array<uint16_t, 4> SR{};
+
+    // KT11 maps onto bus's core and claims its registers on bus.
+    explicit KT11(UNIBUS &bus);
 
     template <bool wr>
     inline uint32_t decode(const uint16_t a, const uint16_t mode) {
-        if ((SR[0] & 1) == 0) {
-            return a > 0167777 ? ((uint32_t)a) + 0600000 : a;
-        }
-        const auto i = (a >> 13);
-        if (wr && !pages[mode][i].write()) {
-            SR[0] = (1 << 13) | 1;
-            SR[0] |= (a >> 12) & ~1;
-            if (mode) {
-                SR[0] |= (1 << 5) | (1 << 6);
-            }
-            // SR2 = cpu.PC;
-
-            printf("mmu::decode write to read-only page %06o\n", a);
-            trap(0250); // intfault
-        }
-        if (!pages[mode][i].read()) {
-            SR[0] = (1 << 15) | 1;
-            SR[0] |= (a >> 12) & ~1;
-            if (mode) {
-                SR[0] |= (1 << 5) | (1 << 6);
-            }
-            // SR2 = cpu.PC;
-            printf("mmu::decode read from no-access page %06o\n", a);
-            trap(0250); // intfault
+        const auto &t = tlb[mode][a >> 13];
+        const uint16_t off = a & 017777;
+        if (uint16_t(off - t.lo) < (wr ? t.wlen : t.rlen)) {
+            return t.base + off;
         }
-        const auto block = (a >> 6) & 0177;
-        const auto disp = a & 077;
-        // if ((p.ed() && (block < p.len())) || (!p.ed() && (block > p.len())))
-        // {
-        if (pages[mode][i].ed() ? (block < pages[mode][i].len())
-                                : (block > pages[mode][i].len())) {
-            SR[0] = (1 << 14) | 1;
-            SR[0] |= (a >> 12) & ~1;
-            if (mode) {
-                SR[0] |= (1 << 5) | (1 << 6);
-            }
-            // SR2 = cpu.PC;
-            printf("page length exceeded, address %06o (block %03o) is beyond "
-                   "length "
-                   "%03o\r\n",
-                   a, block, pages[mode][i].len());
-            trap(0250); // intfault
-        }
-        if constexpr (wr) {
-            pages[mode][i].pdr |= 1 << 6;
+        return translate<wr>(a, mode);
+    }
+
+    // host returns a pointer to the core word a maps to in mode, or nullptr
+    // if a is odd, outside core, or the access must go through decode to
+    // fault or set the W bit.
+    template <bool wr>
+    inline uint16_t *host(const uint16_t a, const uint16_t mode) {
+        const auto &t = tlb[mode][a >> 13];
+        const uint16_t off = a & 017777;
+        if (t.ram && ((a & 1) == 0) &&
+            (uint16_t(off - t.lo) < (wr ? t.wlen : t.rlen))) {
+            return t.ram + (off >> 1);
         }
-        const auto aa = ((pages[mode][i].addr() + block) << 6) + disp;
-        // printf("decode: slow %06o -> %06o\n", a, aa);
-        return aa;
+        return nullptr;
     }
 
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
 
+    // snapshot carries the page registers and SR0-SR3, a restore refills
+    // the tlb from them.
+    void snapshot(Snapshot &s);
+
   private:
+    // translate is decode's slow path, it raises any fault and sets the
+    // page's W bit on its first write.
+    template <bool wr> uint32_t translate(uint16_t a, uint16_t mode);
+
     struct page {
         uint16_t par, pdr;
 
@@ -75,6 +61,26 @@ class KT11 {
         inline bool ed() { return pdr & 8; }
     };
 
-    std::array<std::array<page, 8>, 4> pages;
+    std::array<std::array<page, 8>, 4> pages{};
+
+    // tlb holds each page's translation as validated by translate, so a
+    // decode that hits costs a lookup, a compare and an add. Offsets from
+    // lo up to rlen, or wlen for writes, can't fault. wlen is zero until
+    // the page's W bit has been set.
+    struct tlbentry {
+        uint32_t base; // physical address of the page
+        uint16_t lo, rlen, wlen;
+        uint16_t *ram; // core at base, nullptr if the page reaches I/O
+    };
+
+    std::array<std::array<tlbentry, 8>, 4> tlb;
+    UNIBUS &bus;
+    uint16_t *const core;
+
+    // fill refills the tlb entry for page i in mode.
+    void fill(uint16_t mode, uint8_t i);
+
+    // writeSR0 writes SR0, refilling the tlb if it turns the MMU on or off.
+    void writeSR0(uint16_t v);
     void dumppages();
 };
\ No newline at end of file
@@ -1,38 +1,9 @@
 #include "kw11.h"
 #include "avr11.h"
 #include "kb11.h"
-#include <iostream>
-#include <signal.h>
-#include <sys/time.h>
-#include <unistd.h>
+#include <stdio.h>
 
-extern KB11 cpu;
-
-void kw11alarm(int) { cpu.unibus.kw11.tick(); }
-
-KW11::KW11() {
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sa.sa_handler = kw11alarm;
-
-    if (sigaction(SIGALRM, &sa, NULL) < 0)
-        perror("sigaction");
-
-    struct itimerval itv = {
-        .it_interval =
-            {
-                .tv_sec = 0,
-                .tv_usec = 20000LL,
-            },
-        .it_value =
-            {
-                .tv_sec = 0,
-                .tv_usec = 20000LL,
-            },
-    };
-    setitimer(ITIMER_REAL, &itv, NULL);
-}
+KW11::KW11(UNIBUS &bus) : bus(bus) { bus.attach(*this, 0777546, 0777550); }
 
 void KW11::write16(uint32_t a, uint16_t v) {
     switch (a) {
@@ -57,9 +28,25 @@ uint16_t KW11::read16(uint32_t a) {
     }
 }
 
+void KW11::virtualclock(const uint32_t p) {
+    period = p;
+    bus.sched.at(EVCLOCK, period);
+}
+
 void KW11::tick() {
+    if (period) {
+        bus.sched.at(EVCLOCK, period);
+    }
     csr |= (1 << 7);
     if (csr & (1 << 6)) {
-        cpu.interrupt(INTCLOCK, 6);
+        bus.cpu.interrupt(INTCLOCK, 6);
+    }
+}
+
+void KW11::snapshot(Snapshot &s) {
+    s.field(csr);
+    if (s.restoring && period) {
+        // the virtual clock follows this process's choice.
+        bus.sched.at(EVCLOCK, period);
     }
 }
@@ -1,14 +1,28 @@
 #pragma once
 #include <stdint.h>
 
+class Snapshot;
+class UNIBUS;
+
 class KW11 {
   public:
     void write16(uint32_t a, uint16_t v);
     uint16_t read16(uint32_t a);
 
-    KW11();
+    // KW11 ticks whenever EVCLOCK is posted, which a host running the
+    // machine in real time does every 20ms.
+    explicit KW11(UNIBUS &bus);
     void tick();
 
+    // virtualclock drives the clock from the scheduler, ticking every
+    // period instructions rather than in host time. An idle guest then
+    // skips straight to its next tick.
+    void virtualclock(uint32_t period);
+
+    void snapshot(Snapshot &s);
+
   private:
+    UNIBUS &bus;
     uint16_t csr;
+    uint32_t period = 0;
 };
\ No newline at end of file
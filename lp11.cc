@@ -8,16 +8,14 @@
 #include "kb11.h"
 #include "lp11.h"
 
-extern KB11 cpu;
+LP11::LP11(UNIBUS &bus) : bus(bus) { bus.attach(*this, 0777514, 0777520); }
 
 void LP11::poll() {
     if (!(lps & 0x80)) {
-        if (++count > 3000) {
-            fputc(lpb & 0x7f, stdout);
-            lps |= 0x80;
-            if (lps & (1 << 6)) {
-                cpu.interrupt(0200, 4);
-            }
+        fputc(lpb & 0x7f, out);
+        lps |= 0x80;
+        if (lps & (1 << 6)) {
+            bus.cpu.interrupt(0200, 4);
         }
     }
 }
@@ -46,7 +44,7 @@ void LP11::write16(uint32_t a, uint16_t v) {
     case 0777516:
         lpb = v & 0x7f;
         lps &= 0xff7f;
-        count = 0;
+        bus.sched.at(EVLP, latency);
         break;
     default:
         printf("lp11: write to invalid address %06o\n", a);
@@ -58,3 +56,8 @@ void LP11::reset() {
     lps = 0x80;
     lpb = 0;
 }
+
+void LP11::snapshot(Snapshot &s) {
+    s.field(lps);
+    s.field(lpb);
+}
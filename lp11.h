@@ -1,16 +1,30 @@
 #pragma once
 #include <stdint.h>
+#include <stdio.h>
+
+class Snapshot;
+class UNIBUS;
 
 class LP11 {
 
   public:
+    explicit LP11(UNIBUS &bus);
+
+    // latency is the number of instructions taken to print a character.
+    uint32_t latency = 3000;
+
+    // out is where the printer prints.
+    FILE *out = stdout;
+
+    // poll prints lpb once the printer has been given a character.
     void poll();
     void reset();
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
+    void snapshot(Snapshot &s);
 
   private:
+    UNIBUS &bus;
     uint16_t lps;
     uint16_t lpb;
-    uint16_t count;
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include <stdint.h>
+
+#include "avr11.h"
+#include "machine.h"
+
+Machine::Machine(const int in, const int out) {
+    cpu.unibus.cons.connect(in, out);
+}
+
+// trap unwinds to the run loop, which delivers the vector at the
+// instruction boundary. Throwing costs nothing until a trap is taken,
+// unlike setjmp, which had to be rearmed after every interrupt.
+[[noreturn]] void trap(uint16_t vec) { throw trapped{vec}; }
+
+void Machine::stop() {
+    stopped = true;
+    cpu.unibus.sched.signal(EVYIELD);
+}
+
+void Machine::flush() {
+    auto &bus = cpu.unibus;
+    bus.rk11.drain();
+    bus.rh11.drain();
+    bus.rk11.sync();
+    bus.rh11.sync();
+    bus.cons.flush();
+}
+
+stopreason Machine::run(const uint32_t slice) {
+    auto &sched = cpu.unibus.sched;
+    stopped = false;
+    sched.yielding = false;
+    if (slice) {
+        sched.at(EVYIELD, slice);
+    } else {
+        sched.cancel(EVYIELD);
+    }
+    uint16_t vec = 0;
+    while (true) {
+        try {
+            if (vec) {
+                const auto v = vec;
+                vec = 0;
+                cpu.trapat(v);
+            }
+            const bool blocks = translate && (breakpoint < 0);
+            while (true) {
+                if (blocks) {
+                    sched.now += cpu.stepblock();
+                } else {
+                    cpu.step();
+                    sched.now++;
+                }
+                if (cpu.pc() == breakpoint) {
+                    return STOPBREAK;
+                }
+                if (const auto i = cpu.irq(); i.vec) {
+                    cpu.trapat(i.vec);
+                    cpu.popirq(i);
+                    continue;
+                }
+                if (sched.due()) {
+                    sched.run();
+                    if (sched.yielding) {
+                        return stopped ? STOPPED : STOPSLICE;
+                    }
+                }
+            }
+        } catch (const trapped &t) {
+            vec = t.vec;
+        } catch (const halted &) {
+            cpu.unibus.cons.flush();
+            return STOPHALT;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <unistd.h>
+
+#include "kb11.h"
+
+// stopreason says why Machine::run returned.
+enum stopreason {
+    STOPHALT,  // the cpu executed HALT
+    STOPBREAK, // the cpu reached the breakpoint
+    STOPSLICE, // the time slice given to run was used up
+    STOPPED,   // stop was called
+};
+
+// Machine is a whole PDP-11: the cpu, which owns the bus, core and devices,
+// and the host fds its console is connected to. Machines share nothing, so
+// one process may run many, each on its own thread. A machine installs no
+// signal handlers. Whatever runs it reports host events, such as console
+// input or the real-time clock ticking, to its scheduler, and handles
+// EVSNAP and EVCLONE through the scheduler's host.
+class Machine {
+  public:
+    explicit Machine(int in = STDIN_FILENO, int out = STDERR_FILENO);
+
+    KB11 cpu;
+
+    // translate executes translated basic blocks rather than single
+    // instructions.
+    bool translate = false;
+
+    // breakpoint is the PC at which run returns, none if it is negative.
+    // A block may run on past it, so run interprets single instructions
+    // while one is set.
+    int32_t breakpoint = -1;
+
+    // run runs the machine on from where it was left until it halts or
+    // reaches the breakpoint, or with slice set until about that many
+    // instructions have executed. The slice may end a little late, it is
+    // checked only as device events run.
+    stopreason run(uint32_t slice = 0);
+
+    // stop has run return at the next instruction boundary. It must be
+    // called on the thread running the machine, from one of its callbacks
+    // such as the console's watch.
+    void stop();
+
+    // flush brings out everything the guest has written: the transfer in
+    // flight reaches its pack, the packs the host disk, whatever the sync
+    // policy, and the console output its fd. A process running machines
+    // must leave by calling it and then _exit. The I/O threads stay parked
+    // on their IOThread's condition variable, which exit would destroy
+    // under them, and nothing left buffered would be written.
+    void flush();
+
+  private:
+    bool stopped = false;
+};
@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "match.h"
+
+Matcher::Matcher(const std::string &text) : text(text), fail(text.size()) {
+    for (size_t i = 1, k = 0; i < text.size(); i++) {
+        while (k && (text[i] != text[k])) {
+            k = fail[k - 1];
+        }
+        if (text[i] == text[k]) {
+            k++;
+        }
+        fail[i] = k;
+    }
+}
+
+bool Matcher::feed(const uint8_t c) {
+    if (text.empty()) {
+        return true;
+    }
+    while (matched && (c != uint8_t(text[matched]))) {
+        matched = fail[matched - 1];
+    }
+    if (c == uint8_t(text[matched])) {
+        matched++;
+    }
+    if (matched < text.size()) {
+        return false;
+    }
+    matched = 0;
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Matcher looks for text in output fed to it a character at a time. A
+// partial match which fails falls back to the longest part of it which
+// may still begin one, so text which overlaps itself, such as aab in
+// aaab, is found.
+class Matcher {
+  public:
+    explicit Matcher(const std::string &text = "");
+
+    // feed passes on the next character c, returning true once it
+    // completes the text. The search then starts afresh.
+    bool feed(uint8_t c);
+
+  private:
+    std::string text;
+
+    // fail[i] is the length of the longest proper prefix of text which
+    // also ends its first i + 1 characters.
+    std::vector<size_t> fail;
+    size_t matched = 0;
+};
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cstdlib>
+#include <errno.h>
+#include <iterator>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "pack.h"
+
+static const bool bigendian = __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__;
+static const uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+
+// An overlay starts with this header, the bitmap follows at COWBITMAP and
+// the blocks at COWDATA, rounded up to a multiple of COWALIGN.
+struct cowheader {
+    char magic[8];
+    uint64_t capacity; // of the pack, in host byte order
+};
+
+enum {
+    COWBLOCK = 512,
+    COWBITMAP = 512,
+    COWALIGN = 65536,
+};
+
+static const char cowmagic[8] = {'P', 'D', 'P', '1', '1', 'C', 'O', 'W'};
+
+// cowblocks returns the number of blocks in a pack of capacity bytes.
+static size_t cowblocks(const size_t capacity) {
+    return (capacity + COWBLOCK - 1) / COWBLOCK;
+}
+
+// cowdata returns the offset of the first block in the overlay.
+static size_t cowdata(const size_t capacity) {
+    const size_t end = COWBITMAP + ((cowblocks(capacity) + 7) >> 3);
+    return (end + COWALIGN - 1) & ~size_t(COWALIGN - 1);
+}
+
+// cowopen opens the overlay at path and reads its header, which must be
+// present, into h.
+static int cowopen(const char *path, cowheader &h) {
+    const int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    if ((pread(fd, &h, sizeof(h), 0) != sizeof(h)) ||
+        memcmp(h.magic, cowmagic, sizeof(cowmagic))) {
+        fprintf(stderr, "%s: not a pack overlay\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Pack::attach(const char *p, const size_t cap) {
+    path = p;
+    capacity = cap;
+    // with an overlay the image is only read.
+    const char *comma = strchr(p, ',');
+    const std::string base = comma ? std::string(p, comma) : p;
+    if (!comma) {
+        fd = open(base.c_str(), O_RDWR | O_CLOEXEC);
+    }
+    if (comma || ((fd == -1) && ((errno == EACCES) || (errno == EROFS)))) {
+        fd = open(base.c_str(), O_RDONLY | O_CLOEXEC);
+        locked = !comma;
+    }
+    if (fd == -1) {
+        perror(base.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror(base.c_str());
+        return false;
+    }
+    size = std::min<size_t>(st.st_size, capacity);
+    if (size) {
+        const int prot =
+            (comma || locked) ? PROT_READ : PROT_READ | PROT_WRITE;
+        image = static_cast<uint8_t *>(
+            mmap(nullptr, size, prot, MAP_SHARED, fd, 0));
+        if (image == MAP_FAILED) {
+            perror("mmap");
+            image = nullptr;
+            return false;
+        }
+    }
+    return comma ? overlay(comma + 1) : true;
+}
+
+// overlay maps the overlay at path, creating it if it is missing or empty.
+bool Pack::overlay(const char *path) {
+    const int dfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (dfd == -1) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(dfd, &st) == -1) {
+        perror(path);
+        return false;
+    }
+    const size_t len = cowdata(capacity) + cowblocks(capacity) * COWBLOCK;
+    if (st.st_size == 0) {
+        cowheader h = {};
+        memcpy(h.magic, cowmagic, sizeof(cowmagic));
+        h.capacity = capacity;
+        if ((pwrite(dfd, &h, sizeof(h), 0) != sizeof(h)) ||
+            (ftruncate(dfd, len) == -1)) {
+            perror(path);
+            return false;
+        }
+    } else {
+        cowheader h;
+        if ((pread(dfd, &h, sizeof(h), 0) != sizeof(h)) ||
+            memcmp(h.magic, cowmagic, sizeof(cowmagic)) ||
+            (h.capacity != capacity) || (size_t(st.st_size) != len)) {
+            fprintf(stderr, "%s: not an overlay for this pack\n", path);
+            return false;
+        }
+    }
+    auto *const p = static_cast<uint8_t *>(
+        mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, dfd, 0));
+    close(dfd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    delta = p;
+    bitmap = p + COWBITMAP;
+    data = p + cowdata(capacity);
+    return true;
+}
+
+bool Pack::merge(const char *base, const char *path) {
+    cowheader h;
+    const int dfd = cowopen(path, h);
+    if (dfd == -1) {
+        return false;
+    }
+    const int bfd = open(base, O_RDWR | O_CLOEXEC);
+    if (bfd == -1) {
+        perror(base);
+        close(dfd);
+        return false;
+    }
+    const size_t blocks = cowblocks(h.capacity);
+    std::vector<uint8_t> bits((blocks + 7) >> 3);
+    bool ok = pread(dfd, bits.data(), bits.size(), COWBITMAP) ==
+              ssize_t(bits.size());
+    uint8_t buf[COWBLOCK];
+    for (size_t b = 0; ok && (b < blocks); b++) {
+        if (!(bits[b >> 3] & (1 << (b & 7)))) {
+            continue;
+        }
+        const off_t off = b * COWBLOCK;
+        ok = (pread(dfd, buf, COWBLOCK, cowdata(h.capacity) + off) ==
+              COWBLOCK) &&
+             (pwrite(bfd, buf, COWBLOCK, off) == COWBLOCK);
+    }
+    // the overlay is only discarded once its blocks are safely in base.
+    ok = ok && (fsync(bfd) == 0);
+    if (!ok) {
+        perror(base);
+    }
+    close(bfd);
+    close(dfd);
+    return ok && discard(path);
+}
+
+bool Pack::discard(const char *path) {
+    cowheader h;
+    const int dfd = cowopen(path, h);
+    if (dfd == -1) {
+        return false;
+    }
+    // clear the bitmap and release the blocks.
+    const size_t len = cowdata(h.capacity);
+    const std::vector<uint8_t> zero((cowblocks(h.capacity) + 7) >> 3);
+    const bool ok =
+        (pwrite(dfd, zero.data(), zero.size(), COWBITMAP) ==
+         ssize_t(zero.size())) &&
+        (ftruncate(dfd, len) == 0) &&
+        (ftruncate(dfd, len + cowblocks(h.capacity) * COWBLOCK) == 0) &&
+        (fsync(dfd) == 0);
+    if (!ok) {
+        perror(path);
+    }
+    close(dfd);
+    return ok;
+}
+
+bool Pack::forked(const std::string &p) {
+    if (!attached() || locked) {
+        return true;
+    }
+    // the clone starts from the pack as it is, not a stale overlay.
+    if ((truncate(p.c_str(), 0) == -1) && (errno != ENOENT)) {
+        perror(p.c_str());
+        return false;
+    }
+    uint8_t *const old = delta;
+    const uint8_t *const oldbitmap = bitmap;
+    const uint8_t *const olddata = data;
+    if (!overlay(p.c_str())) {
+        return false;
+    }
+    if (old) {
+        // carry over the blocks written to the old overlay.
+        for (size_t b = 0; b < cowblocks(capacity); b++) {
+            if (oldbitmap[b >> 3] & (1 << (b & 7))) {
+                memcpy(data + b * COWBLOCK, olddata + b * COWBLOCK, COWBLOCK);
+                bitmap[b >> 3] |= 1 << (b & 7);
+            }
+        }
+        munmap(old, cowdata(capacity) + cowblocks(capacity) * COWBLOCK);
+    }
+    path = path.substr(0, path.find(',')) + "," + p;
+    dirty.clear();
+    return true;
+}
+
+void Pack::reserve(const size_t end) {
+    if (delta || (end <= size)) {
+        return;
+    }
+    if (ftruncate(fd, capacity) == -1) {
+        perror("pack: ftruncate");
+        std::abort();
+    }
+    void *p;
+    if (image) {
+        p = mremap(image, size, capacity, MREMAP_MAYMOVE);
+    } else {
+        p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (p == MAP_FAILED) {
+        perror("pack: mmap");
+        std::abort();
+    }
+    image = static_cast<uint8_t *>(p);
+    size = capacity;
+}
+
+// copy copies len bytes of the image at off to p, past the end of an image
+// shorter than the pack reads as zero.
+void Pack::copy(const size_t off, uint8_t *const p, const size_t len) const {
+    const size_t got = off < size ? std::min(len, size - off) : 0;
+    if (got) {
+        memcpy(p, image + off, got);
+    }
+    memset(p + got, 0, len - got);
+}
+
+// promote copies the blocks from off to off+len which haven't yet been
+// written from the image into the overlay, unless the write covers them,
+// and returns where the bytes at off are in it.
+uint8_t *Pack::promote(const size_t off, const size_t len) {
+    for (size_t b = off / COWBLOCK; b * COWBLOCK < off + len; b++) {
+        const size_t start = b * COWBLOCK;
+        if (bitmap[b >> 3] & (1 << (b & 7))) {
+            continue;
+        }
+        if ((off > start) || (off + len < start + COWBLOCK)) {
+            copy(start, data + start, COWBLOCK);
+        }
+        bitmap[b >> 3] |= 1 << (b & 7);
+    }
+    return data + off;
+}
+
+// resident reports whether the len bytes mapped at p are all in the host
+// page cache.
+static bool resident(const uint8_t *const p, const size_t len) {
+    const uintptr_t end = reinterpret_cast<uintptr_t>(p) + len;
+    unsigned char vec[64];
+    for (uintptr_t a = reinterpret_cast<uintptr_t>(p) & ~(pagesize - 1);
+         a < end; a += sizeof(vec) * pagesize) {
+        const size_t n = std::min<uintptr_t>(end - a, sizeof(vec) * pagesize);
+        if (mincore(reinterpret_cast<void *>(a), n, vec) == -1) {
+            return false;
+        }
+        for (size_t i = 0; i < (n + pagesize - 1) / pagesize; i++) {
+            if (!(vec[i] & 1)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// cached reports whether the len bytes of the image at off are in the host
+// page cache, any past its end read as zero and so always are.
+bool Pack::cached(const size_t off, const size_t len) const {
+    return off >= size || resident(image + off, std::min(len, size - off));
+}
+
+// willneed asks the host to read the bytes from lo to hi mapped at p.
+static void willneed(uint8_t *const p, const size_t lo, const size_t hi) {
+    if (lo >= hi) {
+        return;
+    }
+    const size_t start = lo & ~(pagesize - 1);
+    [[maybe_unused]] const auto r =
+        madvise(p + start, hi - start, MADV_WILLNEED);
+}
+
+// prefetch follows the reads, once one carries on from where the last
+// ended it keeps a window of readahead bytes past them on the way in from
+// the host disk.
+void Pack::prefetch(const size_t off, const size_t len) {
+    const size_t end = off + len;
+    const bool sequential = off == next;
+    next = end;
+    if (!readahead || !sequential) {
+        return;
+    }
+    if ((ahead < end) || (ahead > end + readahead)) {
+        // a new run.
+        ahead = end;
+    }
+    // top the window up once it is half used.
+    if (end + readahead / 2 <= ahead) {
+        return;
+    }
+    const size_t hi = std::min(end + readahead, capacity);
+    willneed(image, ahead, std::min(hi, size));
+    if (delta) {
+        willneed(data, ahead, hi);
+    }
+    ahead = hi;
+    stats.readaheads++;
+}
+
+void Pack::read(const size_t off, uint16_t *const p, const uint32_t n) {
+    const size_t len = size_t(n) << 1;
+    auto *const q = reinterpret_cast<uint8_t *>(p);
+    bool hit = true;
+    if (delta) {
+        // a block at a time, from the overlay if it has been written.
+        for (size_t done = 0; done < len;) {
+            const size_t o = off + done;
+            const size_t b = o / COWBLOCK;
+            const size_t chunk = std::min(len - done, (b + 1) * COWBLOCK - o);
+            if (bitmap[b >> 3] & (1 << (b & 7))) {
+                hit = hit && resident(data + o, chunk);
+                memcpy(q + done, data + o, chunk);
+            } else {
+                hit = hit && cached(o, chunk);
+                copy(o, q + done, chunk);
+            }
+            done += chunk;
+        }
+    } else {
+        hit = cached(off, len);
+        copy(off, q, len);
+    }
+    if (hit) {
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    prefetch(off, len);
+    if constexpr (bigendian) {
+        for (uint32_t i = 0; i < n; i++) {
+            p[i] = __builtin_bswap16(p[i]);
+        }
+    }
+}
+
+void Pack::write(const size_t off, const uint16_t *const p, const uint32_t n) {
+    uint8_t *const dst = delta ? promote(off, size_t(n) << 1) : image + off;
+    if constexpr (bigendian) {
+        auto *const q = reinterpret_cast<uint16_t *>(dst);
+        for (uint32_t i = 0; i < n; i++) {
+            q[i] = __builtin_bswap16(p[i]);
+        }
+    } else {
+        memcpy(dst, p, size_t(n) << 1);
+    }
+}
+
+bool Pack::written(const size_t off, const size_t len) {
+    const bool clean = dirty.empty();
+    size_t start = off, end = off + len;
+    // merge the runs this one touches or abuts.
+    auto it = dirty.upper_bound(off);
+    if ((it != dirty.begin()) && (std::prev(it)->second >= off)) {
+        --it;
+        start = it->first;
+    }
+    while ((it != dirty.end()) && (it->first <= end)) {
+        end = std::max(end, it->second);
+        it = dirty.erase(it);
+    }
+    dirty[start] = end;
+    return clean;
+}
+
+void Pack::sync() {
+    if (dirty.empty()) {
+        return;
+    }
+    // the written blocks reach the disk before the bitmap marking them.
+    // The mappings start on a page, runs sharing one are flushed together.
+    uint8_t *const base = delta ? data : image;
+    for (auto it = dirty.begin(); it != dirty.end();) {
+        const size_t lo = it->first & ~(pagesize - 1);
+        size_t hi = it->second;
+        for (++it; (it != dirty.end()) && ((it->first & ~(pagesize - 1)) < hi);
+             ++it) {
+            hi = std::max(hi, it->second);
+        }
+        if (msync(base + lo, hi - lo, MS_SYNC) == -1) {
+            perror("pack: msync");
+        }
+        stats.flushes++;
+    }
+    dirty.clear();
+    if (delta && (msync(delta, data - delta, MS_SYNC) == -1)) {
+        perror("pack: msync");
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// syncpolicy selects when writes to the mapped disk images are flushed to
+// the host disk. They reach the page cache, and so survive the emulator
+// exiting, as soon as they are made.
+enum syncpolicy {
+    SYNCEXIT,     // leave writeback to the host kernel
+    SYNCWRITE,    // msync each write as it completes
+    SYNCPERIODIC, // msync syncperiod instructions after the first write
+};
+
+// packstats counts how a pack's transfers fared in the host page cache,
+// which serves as its block cache. A read hits if all of it was resident.
+struct packstats {
+    std::atomic<uint64_t> hits{0}, misses{0};
+    std::atomic<uint64_t> readaheads{0}; // windows read ahead
+    std::atomic<uint64_t> flushes{0};    // runs of written bytes synced
+};
+
+// Pack is a disk pack image, mapped shared so that the host page cache
+// serves as the disk cache and writes survive the simulator exiting.
+// Offsets and lengths are in bytes, words are little endian in the image.
+//
+// A pack may instead be an overlay on a base image, which is only ever
+// read and so may be shared by many simulators. Writes go to an overlay
+// file holding a bitmap of the blocks written, followed by those blocks at
+// their offsets in the pack, sparsely.
+class Pack {
+  public:
+    // attach maps the image at path for a pack holding capacity bytes,
+    // nothing is read until it is used. An image which can only be opened
+    // for reading is write locked. A path of the form base,overlay opens
+    // base read only and writes to overlay, which is created if need be.
+    // It returns false on failure.
+    bool attach(const char *path, size_t capacity);
+
+    // merge copies the blocks written to overlay into base, then discards
+    // them. discard empties overlay, leaving the pack as its base image.
+    static bool merge(const char *base, const char *overlay);
+    static bool discard(const char *overlay);
+
+    // forked turns the pack into a new overlay at path on the pack as it
+    // stands, so that a clone's writes are its own. The base, and any
+    // overlay the pack already had, are only read from then on. A pack
+    // which is write locked is left alone. It returns false on failure.
+    bool forked(const std::string &path);
+
+    inline bool attached() const { return fd != -1; }
+
+    std::string path; // as given to attach
+
+    bool locked = false; // write locked
+
+    // readahead is how far past a run of sequential reads to ask the host
+    // to bring the pack in, in bytes, none if zero.
+    size_t readahead = 0;
+
+    packstats stats;
+
+    // reserve extends an image shorter than the pack, sparsely, before a
+    // write ending at end lands past it. It must not run while a transfer
+    // is in flight.
+    void reserve(size_t end);
+
+    // read copies n words at off into p, past the end of an image shorter
+    // than the pack reads as zero. write copies n words from p to off.
+    // Both may run on an I/O thread.
+    void read(size_t off, uint16_t *p, uint32_t n);
+    void write(size_t off, const uint16_t *p, uint32_t n);
+
+    // written notes that len bytes at off were written, it returns true if
+    // they are the first since the last sync.
+    bool written(size_t off, size_t len);
+
+    // sync flushes the bytes written since the last sync to the host disk,
+    // a run of adjacent writes at a time.
+    void sync();
+
+  private:
+    int fd = -1;
+    size_t capacity = 0;
+    uint8_t *image = nullptr;
+    size_t size = 0; // the length of the image
+
+    // dirty maps the start of each run of bytes written since the last
+    // sync to its end, adjacent writes are merged into one run.
+    std::map<size_t, size_t> dirty;
+
+    // next is where a read following the last would start, ahead where
+    // the window last read ahead ends. Both belong to the I/O thread.
+    size_t next = SIZE_MAX, ahead = 0;
+
+    // delta maps the overlay, if there is one. Its blocks start at data,
+    // bitmap marks those which have been written.
+    uint8_t *delta = nullptr;
+    uint8_t *bitmap = nullptr;
+    uint8_t *data = nullptr;
+
+    bool overlay(const char *path);
+    void copy(size_t off, uint8_t *p, size_t len) const;
+    uint8_t *promote(size_t off, size_t len);
+    void prefetch(size_t off, size_t len);
+    bool cached(size_t off, size_t len) const;
+};
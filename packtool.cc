@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pack.h"
+
+// packtool folds the writes held in a pack overlay back into its base
+// image, or throws them away.
+int main(int argc, char *argv[]) {
+    if ((argc == 4) && !strcmp(argv[1], "merge")) {
+        return Pack::merge(argv[2], argv[3]) ? 0 : 1;
+    }
+    if ((argc == 3) && !strcmp(argv[1], "discard")) {
+        return Pack::discard(argv[2]) ? 0 : 1;
+    }
+    fprintf(stderr,
+            "usage: %s merge base overlay\n"
+            "       %s discard overlay\n",
+            argv[0], argv[0]);
+    return 1;
+}
@@ -1,16 +1,36 @@
 #include "pc11.h"
 #include "avr11.h"
+#include "unibus.h"
 #include <cstdlib>
 #include <stdio.h>
 
+PC11::PC11(UNIBUS &bus) { bus.attach(*this, 0777550, 0777554); }
+
 uint16_t PC11::read16(uint32_t a) {
     switch (a & 6) {
         case 0: // ptr11.prs  777550
-            break;
+            return prs;
         case 2: // ptr11.pdb  777552
             prs = prs & ~0x80; // Clear DONE,
             return prb;
     }
-    printf("mmu::read16 invalid read from %06o\n", a);
-    trap(004);
-}
\ No newline at end of file
+    printf("pc11: read from invalid address %06o\n", a);
+    trap(INTBUS);
+}
+
+void PC11::write16(uint32_t a, uint16_t v) {
+    switch (a & 6) {
+        case 0: // ptr11.prs  777550
+            prs = (prs & ~0100) | (v & 0100); // only interrupt enable
+            return;
+    }
+    printf("pc11: write to invalid address %06o\n", a);
+    trap(INTBUS);
+}
+
+void PC11::snapshot(Snapshot &s) {
+    s.field(prs);
+    s.field(prb);
+    s.field(pps);
+    s.field(ppb);
+}
@@ -1,10 +1,17 @@
+#pragma once
 #include <stdint.h>
 
+class Snapshot;
+class UNIBUS;
 
 class PC11 {
 
     public:
-    uint16_t prs, prb, pps, ppb;
+    explicit PC11(UNIBUS &bus);
+
+    uint16_t prs{}, prb{}, pps{}, ppb{};
 
     uint16_t read16(uint32_t a);
+    void write16(uint32_t a, uint16_t v);
+    void snapshot(Snapshot &s);
 };
\ No newline at end of file
@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <cstdlib>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "avr11.h"
+#include "kb11.h"
+#include "rh11.h"
+
+// RPCS1 bits
+enum {
+    RPGO = (1 << 0),
+    RPIE = (1 << 6),
+    RPRDY = (1 << 7),
+    RPDVA = (1 << 11),
+    RPTRE = (1 << 14),
+    RPSC = (1 << 15),
+    RPCS1RW = 01576, // function, interrupt enable and A16-A17
+};
+
+// RPCS2 bits
+enum {
+    RPCLR = (1 << 5),
+    RPPGE = (1 << 10),
+    RPNEM = (1 << 11),
+    RPNED = (1 << 12),
+    RPWCE = (1 << 14),
+    RPCS2RW = 037,       // unit, BAI and PAT
+    RPCS2ERR = 0177400, // cleared by writing TRE
+};
+
+// RPDS bits
+enum {
+    RPATA = (1 << 15),
+    RPERR = (1 << 14),
+    RPMOL = (1 << 12),
+    RPWRL = (1 << 11),
+    RPDPR = (1 << 8),
+    RPDRY = (1 << 7),
+    RPVV = (1 << 6),
+};
+
+// RPER1 bits
+enum {
+    RPILF = (1 << 0),
+    RPAOE = (1 << 9),
+    RPIAE = (1 << 10),
+    RPWLE = (1 << 11),
+};
+
+// RP04 and RP06 geometry, the packs differ only in their cylinders. The
+// pack turns at 3600rpm, so a sector passes the heads every 758us.
+enum {
+    RPSECTORS = 22,
+    RPTRACKS = 19,
+    RPCYLINDER = RPSECTORS * RPTRACKS * 512, // bytes
+    RPSECTOR = 758,
+};
+
+RH11::RH11(UNIBUS &bus) : bus(bus), iothread(bus.sched, EVRPIO) {
+    bus.attach(*this, 0776700, 0776750);
+}
+
+bool RH11::attach(const uint8_t unit, const char *path, const bool rp04) {
+    auto &d = drives[unit];
+    d.rp04 = rp04;
+    return d.pack.attach(path, d.cylinders() * RPCYLINDER);
+}
+
+void RH11::sync() {
+    for (auto &d : drives) {
+        d.pack.sync();
+    }
+}
+
+void RH11::drain() {
+    iothread.drain();
+    // the write is on the pack now, sync must find it even if complete
+    // never runs.
+    if (busy && io.w) {
+        drives[io.unit].pack.written(io.off, io.n << 1);
+    }
+}
+
+bool RH11::forked(const std::string &prefix) {
+    iothread.forked();
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        if (!drives[i].pack.forked(prefix + "rp" + std::to_string(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RH11::readahead(const uint32_t cylinders) {
+    for (auto &d : drives) {
+        d.pack.readahead = cylinders * RPCYLINDER;
+    }
+}
+
+void RH11::report() {
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        const auto &s = drives[i].pack.stats;
+        if (drives[i].pack.attached()) {
+            fprintf(stderr,
+                    "rh11: unit %d: %" PRIu64 " hits %" PRIu64
+                    " misses %" PRIu64 " readaheads %" PRIu64 " flushes\n",
+                    i, s.hits.load(), s.misses.load(), s.readaheads.load(),
+                    s.flushes.load());
+        }
+    }
+}
+
+// present reports whether the selected unit has a drive, accessing one
+// which doesn't is a transfer error.
+bool RH11::present() {
+    if (selected().pack.attached()) {
+        return true;
+    }
+    cs2 |= RPNED;
+    tre = true;
+    return false;
+}
+
+uint16_t RH11::read16(const uint32_t a) {
+    switch (a) {
+    case 0776700: {
+        // 776700 Control and Status 1
+        uint16_t v = cs1 & RPCS1RW;
+        if (!busy) {
+            v |= RPRDY;
+        }
+        if (selected().pack.attached()) {
+            v |= RPDVA;
+        }
+        if (tre) {
+            v |= RPTRE | RPSC;
+        }
+        for (const auto &d : drives) {
+            if (d.ata) {
+                v |= RPSC;
+            }
+        }
+        return v;
+    }
+    case 0776702:
+        // 776702 Word Count
+        return wc;
+    case 0776704:
+        // 776704 Bus Address
+        return ba;
+    case 0776710:
+        // 776710 Control and Status 2
+        return cs2;
+    case 0776716: {
+        // 776716 Attention Summary, one bit for each drive
+        uint16_t as = 0;
+        for (uint8_t i = 0; i < drives.size(); i++) {
+            if (drives[i].ata) {
+                as |= 1 << i;
+            }
+        }
+        return as;
+    }
+    default:
+        break;
+    }
+
+    // the rest are registers of the selected drive.
+    if (!present()) {
+        return 0;
+    }
+    const auto &d = selected();
+    switch (a) {
+    case 0776706:
+        // 776706 Desired Sector/Track Address
+        return d.da;
+    case 0776712: {
+        // 776712 Drive Status
+        uint16_t ds = RPMOL | RPDPR;
+        if (!busy || (io.unit != (cs2 & 7))) {
+            ds |= RPDRY;
+        }
+        if (d.ata) {
+            ds |= RPATA;
+        }
+        if (d.er1) {
+            ds |= RPERR;
+        }
+        if (d.pack.locked) {
+            ds |= RPWRL;
+        }
+        if (d.vv) {
+            ds |= RPVV;
+        }
+        return ds;
+    }
+    case 0776714:
+        // 776714 Error 1
+        return d.er1;
+    case 0776720:
+        // 776720 Look Ahead, the sector coming under the heads
+        return ((bus.sched.now / RPSECTOR) % RPSECTORS) << 6;
+    case 0776726:
+        // 776726 Drive Type
+        return d.rp04 ? 020020 : 020022;
+    case 0776730:
+        // 776730 Serial Number
+        return (cs2 & 7) + 1;
+    case 0776732:
+        // 776732 Offset
+        return d.of;
+    case 0776734:
+        // 776734 Desired Cylinder
+        return d.dc;
+    case 0776736:
+        // 776736 Current Cylinder
+        return d.cc;
+    default:
+        // data buffer, maintenance, error 2 and 3 and the ECC registers.
+        return 0;
+    }
+}
+
+void RH11::write16(const uint32_t a, const uint16_t v) {
+    switch (a) {
+    case 0776700:
+        if (v & RPTRE) {
+            // writing TRE clears the controller errors.
+            tre = false;
+            cs2 &= ~RPCS2ERR;
+        }
+        if ((v & RPGO) && busy) {
+            // the controller isn't ready for another command.
+            cs2 |= RPPGE;
+            tre = true;
+            return;
+        }
+        cs1 = (cs1 & ~RPCS1RW) | (v & RPCS1RW);
+        if (v & RPGO) {
+            if (present()) {
+                go(v & 077);
+            } else {
+                done();
+            }
+        } else if ((v & RPIE) && !busy) {
+            // setting IE while ready interrupts at once.
+            done();
+        }
+        return;
+    case 0776702:
+        wc = v;
+        return;
+    case 0776704:
+        ba = v & ~1;
+        return;
+    case 0776710:
+        if (v & RPCLR) {
+            // controller clear
+            reset();
+            return;
+        }
+        cs2 = (cs2 & ~RPCS2RW) | (v & RPCS2RW);
+        return;
+    case 0776716:
+        for (uint8_t i = 0; i < drives.size(); i++) {
+            if (v & (1 << i)) {
+                drives[i].ata = false;
+            }
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (!present()) {
+        return;
+    }
+    auto &d = selected();
+    switch (a) {
+    case 0776706:
+        d.da = v & 017437;
+        break;
+    case 0776714:
+        d.er1 = v;
+        break;
+    case 0776732:
+        d.of = v;
+        break;
+    case 0776734:
+        d.dc = v & 01777;
+        break;
+    default:
+        // the rest are read only, or do nothing here.
+        break;
+    }
+}
+
+// attention raises d's attention, interrupting if the controller is idle.
+void RH11::attention(rp &d) {
+    d.ata = true;
+    if (!busy) {
+        done();
+    }
+}
+
+// error ends the selected drive's command with the errors e.
+void RH11::error(rp &d, const uint16_t e) {
+    d.er1 |= e;
+    attention(d);
+}
+
+// done signals that the controller is ready, the RH11 clears IE as the
+// interrupt is taken.
+void RH11::done() {
+    if (cs1 & RPIE) {
+        cs1 &= ~RPIE;
+        bus.cpu.interrupt(INTRP, 5);
+    }
+}
+
+void RH11::go(const uint8_t f) {
+    auto &d = selected();
+    if (d.er1 && (f != 011)) {
+        // a drive with errors only takes drive clear.
+        return;
+    }
+    d.ata = false;
+    switch (f) {
+    case 01: // NOP
+    case 013: // release
+        break;
+    case 03: // unload, the pack stays loaded
+    case 015: // offset
+    case 017: // return to centreline
+        attention(d);
+        break;
+    case 07: // recalibrate
+        d.dc = d.cc = 0;
+        attention(d);
+        break;
+    case 05: // seek
+    case 031: // search
+        if ((d.dc >= d.cylinders()) || (((d.da >> 8) & 037) >= RPTRACKS) ||
+            ((d.da & 037) >= RPSECTORS)) {
+            error(d, RPIAE);
+            break;
+        }
+        d.cc = d.dc;
+        attention(d);
+        break;
+    case 011: // drive clear
+        d.er1 = 0;
+        break;
+    case 021: // read-in preset
+        d.da = d.dc = d.of = 0;
+        d.vv = true;
+        break;
+    case 023: // pack acknowledge
+        d.vv = true;
+        break;
+    case 051: // write check
+    case 061: // write
+    case 071: // read
+        readwrite(f);
+        break;
+    default:
+        // the header functions and the rest.
+        error(d, RPILF);
+        break;
+    }
+}
+
+// readwrite hands a transfer of wc words between the selected drive and
+// core at the 18 bit bus address to the I/O thread, the guest runs on
+// while it is in flight.
+void RH11::readwrite(const uint8_t f) {
+    auto &d = selected();
+    const uint32_t track = (d.da >> 8) & 037, sector = d.da & 037;
+    uint16_t e = 0;
+    if ((d.dc >= d.cylinders()) || (track >= RPTRACKS) ||
+        (sector >= RPSECTORS)) {
+        e = RPIAE;
+    } else if ((f == 061) && d.pack.locked) {
+        e = RPWLE;
+    }
+    if (e) {
+        d.er1 |= e;
+        d.ata = true;
+        tre = true;
+        done();
+        return;
+    }
+
+    // wc holds the two's complement of the words to transfer, the transfer
+    // stops at the end of the pack or of core.
+    const uint32_t pos =
+        ((d.dc * RPTRACKS + track) * RPSECTORS + sector) * 256;
+    const uint32_t size = d.cylinders() * (RPCYLINDER >> 1);
+    uint32_t n = std::min<uint32_t>(0200000 - wc, size - pos);
+    const uint32_t addr = ((cs1 & 01400) << 8) | ba;
+    const bool nem = addr + (n << 1) > IOBASE_18BIT;
+    if (nem) {
+        n = addr < IOBASE_18BIT ? (IOBASE_18BIT - addr) >> 1 : 0;
+    }
+    if (f == 061) {
+        d.pack.reserve((pos + n) << 1);
+    }
+
+    io = {f == 061, f == 051, uint8_t(cs2 & 7), addr, pos << 1, n, nem, false};
+    busy = true;
+    d.cc = d.dc;
+    iothread.submit([this] { perform(io); });
+}
+
+// perform copies the words of t, or compares them, it runs on the I/O
+// thread.
+void RH11::perform(transfer &t) {
+    auto &d = drives[t.unit];
+    auto *const p = bus.core.data() + (t.ba >> 1);
+    if (t.check) {
+        std::vector<uint16_t> buf(t.n);
+        d.pack.read(t.off, buf.data(), t.n);
+        t.mismatch = !std::equal(buf.begin(), buf.end(), p);
+    } else if (t.w) {
+        d.pack.write(t.off, p, t.n);
+    } else {
+        d.pack.read(t.off, p, t.n);
+    }
+}
+
+void RH11::complete() {
+    if (!busy || !iothread.finished()) {
+        return;
+    }
+    busy = false;
+
+    auto &d = drives[io.unit];
+    if (io.w) {
+        const bool clean = d.pack.written(io.off, io.n << 1);
+        switch (policy) {
+        case SYNCWRITE:
+            d.pack.sync();
+            break;
+        case SYNCPERIODIC:
+            // the first write since the last sync starts the period.
+            if (clean) {
+                bus.sched.at(EVSYNC, syncperiod);
+            }
+            break;
+        default:
+            break;
+        }
+    } else if (!io.check) {
+        bus.cpu.invalidate(io.ba, io.n << 1);
+    }
+
+    // the bus address carries into A16-A17.
+    const uint32_t addr = io.ba + (io.n << 1);
+    ba = addr;
+    cs1 = (cs1 & ~01400) | ((addr >> 8) & 01400);
+    wc += io.n;
+
+    // leave the disk address at the sector following the transfer.
+    const auto next = ((io.off >> 1) + io.n + 255) >> 8;
+    d.da = (((next / RPSECTORS) % RPTRACKS) << 8) | (next % RPSECTORS);
+    d.dc = next / (RPSECTORS * RPTRACKS);
+    d.cc = std::min<uint32_t>(d.dc, d.cylinders() - 1);
+
+    if (io.nem) {
+        cs2 |= RPNEM;
+        tre = true;
+    } else if (wc != 0) {
+        // the transfer ran off the end of the pack.
+        d.er1 |= RPAOE;
+        d.ata = true;
+        tre = true;
+    }
+    if (io.mismatch) {
+        cs2 |= RPWCE;
+        tre = true;
+    }
+    done();
+}
+
+void RH11::reset() {
+    // a transfer in flight finishes, but is never reported.
+    drain();
+    iothread.finished();
+    busy = false;
+    for (auto &d : drives) {
+        d.er1 = 0;
+        d.ata = false;
+    }
+    cs1 = 0;
+    wc = 0;
+    ba = 0;
+    cs2 = 0;
+    tre = false;
+}
+
+void RH11::snapshot(Snapshot &s) {
+    if (!s.restoring) {
+        // the transfer in flight reaches the pack and core first.
+        drain();
+        sync();
+    }
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        auto &d = drives[i];
+        s.field(d.rp04);
+        std::string path = d.pack.attached() ? d.pack.path : "";
+        s.string(path);
+        if (s.restoring && !path.empty() && !attach(i, path.c_str(), d.rp04)) {
+            s.fail("can't attach " + path);
+        }
+        bool locked = d.pack.locked;
+        s.field(locked);
+        d.pack.locked |= locked;
+        s.field(d.er1);
+        s.field(d.da);
+        s.field(d.dc);
+        s.field(d.cc);
+        s.field(d.of);
+        s.field(d.ata);
+        s.field(d.vv);
+    }
+    s.field(cs1);
+    s.field(wc);
+    s.field(ba);
+    s.field(cs2);
+    s.field(tre);
+    s.field(io);
+    s.field(busy);
+    if (s.restoring && s.ok() && busy) {
+        iothread.submit([this] { perform(io); });
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <array>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "iothread.h"
+#include "pack.h"
+
+class Snapshot;
+class UNIBUS;
+
+// RH11 is a Massbus disk controller with up to eight RP04 or RP06 drives.
+// Its transfers reach all 18 bits of the address space. Seeks and searches
+// finish as soon as they are issued; there is no timing model.
+class RH11 {
+
+  public:
+    explicit RH11(UNIBUS &bus);
+
+    syncpolicy policy = SYNCEXIT;
+    uint32_t syncperiod = 10000000;
+
+    // attach maps the disk image at path as unit, an RP04 if rp04 is set
+    // and an RP06 otherwise. An image which can only be opened for reading
+    // is write locked. It returns false on failure.
+    bool attach(uint8_t unit, const char *path, bool rp04);
+
+    // complete finishes the transfer in flight once the I/O thread has
+    // performed it.
+    void complete();
+
+    // sync flushes the written parts of the images to the host disk.
+    void sync();
+
+    // readahead sets how many cylinders past a run of sequential reads are
+    // brought in from the host disk ahead of the guest asking for them.
+    void readahead(uint32_t cylinders);
+
+    // report prints each drive's cache counters to stderr.
+    void report();
+
+    // drain waits for the transfer in flight, if any, to reach the pack
+    // and core.
+    void drain();
+
+    // forked must run in a clone after fork. Each pack becomes an overlay
+    // at prefix followed by rp and the drive number, so the clone's writes
+    // are its own. It returns false on failure.
+    bool forked(const std::string &prefix);
+
+    uint16_t read16(uint32_t a);
+    void write16(uint32_t a, uint16_t v);
+    void reset();
+
+    // snapshot carries the controller, its drives and the paths of their
+    // packs, which a restore attaches. A transfer in flight is performed
+    // again once restored.
+    void snapshot(Snapshot &s);
+
+  private:
+    UNIBUS &bus;
+
+    // cs1 holds the interrupt enable, the high bits of the bus address and
+    // the last function, the rest of RPCS1 is made up as it is read.
+    uint16_t cs1, wc, ba, cs2;
+    bool tre; // transfer error
+
+    // An RP04 or RP06 drive and the pack loaded in it.
+    struct rp {
+        Pack pack;
+        bool rp04 = false;
+        uint16_t er1 = 0;
+        uint16_t da = 0; // track and sector
+        uint16_t dc = 0; // desired cylinder
+        uint16_t cc = 0; // current cylinder
+        uint16_t of = 0; // offset
+        bool ata = false, vv = false;
+
+        inline uint32_t cylinders() const { return rp04 ? 411 : 815; }
+    };
+
+    std::array<rp, 8> drives;
+
+    // A transfer handed to the I/O thread, which copies n words between
+    // the unit's image at byte off and core at ba, or compares them if
+    // check is set. The controller is busy until complete has run.
+    struct transfer {
+        bool w, check;
+        uint8_t unit;
+        uint32_t ba, off, n;
+        bool nem;      // the transfer ran off the end of core
+        bool mismatch; // a write check found a difference
+    } io;
+    bool busy = false;
+    IOThread iothread;
+
+    void perform(transfer &t);
+
+    inline rp &selected() { return drives[cs2 & 7]; }
+    bool present();
+    void go(uint8_t f);
+    void readwrite(uint8_t f);
+    void attention(rp &d);
+    void error(rp &d, uint16_t e);
+    void done();
+};
@@ -1,26 +1,110 @@
-#include <assert.h>
+#include <algorithm>
 #include <cstdlib>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
 
 #include "avr11.h"
 #include "kb11.h"
 #include "rk11.h"
 
-extern KB11 cpu;
-
 enum {
     RKOVR = (1 << 14),
+    RKWLO = (1 << 13),
     RKNXD = (1 << 7),
     RKNXC = (1 << 6),
-    RKNXS = (1 << 5)
+    RKNXS = (1 << 5),
+    RKCYLINDER = 24 * 512,    // bytes in a cylinder
+    RKSIZE = 0313 * RKCYLINDER // bytes on an RK05 pack
+};
+
+// RKDS bits
+enum {
+    RKRK05 = (1 << 11),
+    RKSOK = (1 << 8),
+    RKDRY = (1 << 7),
+    RKRWS = (1 << 6),
+    RKWPS = (1 << 5),
+};
+
+// RK05 timings in microseconds, taken as instructions. The pack turns at
+// 1500rpm, so a sector passes the heads every 3333us.
+enum {
+    RKSETTLE = 10000, // a seek of any length
+    RKTRACK = 370,    // and for each cylinder crossed
+    RKSECTOR = 3333,
 };
 
+RK11::RK11(UNIBUS &bus) : bus(bus), iothread(bus.sched, EVRKIO) {
+    bus.attach(*this, 0777400, 0777414);
+}
+
+bool RK11::attach(const uint8_t drive, const char *path) {
+    return drives[drive].pack.attach(path, RKSIZE);
+}
+
+void RK11::sync() {
+    for (auto &d : drives) {
+        d.pack.sync();
+    }
+}
+
+void RK11::drain() {
+    iothread.drain();
+    // the write is on the pack now, sync must find it even if complete
+    // never runs.
+    if (busy && io.w) {
+        drives[io.drive].pack.written(io.off, io.n << 1);
+    }
+}
+
+bool RK11::forked(const std::string &prefix) {
+    iothread.forked();
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        if (!drives[i].pack.forked(prefix + "rk" + std::to_string(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RK11::readahead(const uint32_t cylinders) {
+    for (auto &d : drives) {
+        d.pack.readahead = cylinders * RKCYLINDER;
+    }
+}
+
+void RK11::report() {
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        const auto &s = drives[i].pack.stats;
+        if (drives[i].pack.attached()) {
+            fprintf(stderr,
+                    "rk11: drive %d: %" PRIu64 " hits %" PRIu64
+                    " misses %" PRIu64 " readaheads %" PRIu64 " flushes\n",
+                    i, s.hits.load(), s.misses.load(), s.readaheads.load(),
+                    s.flushes.load());
+        }
+    }
+}
+
 uint16_t RK11::read16(const uint32_t a) {
     switch (a) {
-    case 0777400:
-        // 777400 Drive Status
-        return rkds;
+    case 0777400: {
+        // 777400 Drive Status, of the drive selected by RKDA
+        const auto &d = drives[drive];
+        uint16_t ds = (id << 13) | RKRK05;
+        if (d.pack.attached()) {
+            ds |= RKSOK | RKDRY;
+            if (!busy && !d.seeking) {
+                ds |= RKRWS;
+            }
+            if (d.pack.locked) {
+                ds |= RKWPS;
+            }
+        }
+        return ds;
+    }
     case 0777402:
         // 777402 Error Register
         return rker;
@@ -38,24 +122,38 @@ uint16_t RK11::read16(const uint32_t a) {
     }
 }
 
-void RK11::rknotready() {
-    rkds &= ~(1 << 6);
-    rkcs &= ~(1 << 7);
-}
+void RK11::rknotready() { rkcs &= ~(1 << 7); }
 
 void RK11::rkready() {
-    rkds |= 1 << 6;
     rkcs |= 1 << 7;
     rkcs &= ~1; // no go
 }
 
+// rkerror ends the command with the errors e.
+void RK11::rkerror(const uint16_t e) {
+    rker |= e;
+    rkcs |= 0xc000; // error, hard error
+    rkready();
+    if (rkcs & (1 << 6)) {
+        bus.cpu.interrupt(INTRK, 5);
+    }
+}
+
 void RK11::step() {
     if ((rkcs & 01) == 0) {
         // no GO bit
         return;
     }
+    go();
+}
 
-    switch ((rkcs >> 1) & 7) {
+void RK11::go() {
+    const auto f = (rkcs >> 1) & 7;
+    if ((f != 0) && !drives[drive].pack.attached()) {
+        rkerror(RKNXD);
+        return;
+    }
+    switch (f) {
     case 0:
         // controller reset
         reset();
@@ -63,34 +161,45 @@ void RK11::step() {
     case 1: // write
     case 2: // read
     case 3: // check
-        if (drive != 0) {
-            rker |= 0x8080; // NXD
-            break;
-        }
         if (cylinder > 0312) {
-            rker |= 0x8040; // NXC
+            rkerror(RKNXC);
             break;
         }
         if (sector > 013) {
-            rker |= 0x8020; // NXS
+            rkerror(RKNXS);
+            break;
+        }
+        if ((f == 1) && drives[drive].pack.locked) {
+            rkerror(RKWLO);
             break;
         }
         rknotready();
-        seek();
         readwrite();
         return;
     case 6: // Drive Reset - falls through to be finished as a seek
         rker = 0;
         [[fallthrough]];
-    case 4: // Seek (and drive reset) - complete immediately
+    case 4: // Seek (and drive reset)
+        if (cylinder > 0312) {
+            rkerror(RKNXC);
+            break;
+        }
         seek();
-        rkcs &= ~0x2000; // Clear search complete - reset by rk11_seekEnd
-        rkcs |= 0x80;    // set done - ready to accept new command
-        cpu.interrupt(INTRK, 5);
         break;
-    case 5: // Read Check
+    case 5: // Read Check - nothing to compare against, it always passes
+        id = drive;
+        rkready();
+        if (rkcs & (1 << 6)) {
+            bus.cpu.interrupt(INTRK, 5);
+        }
         break;
-    case 7: // Write Lock - not implemented :-(
+    case 7: // Write Lock
+        drives[drive].pack.locked = true;
+        id = drive;
+        rkready();
+        if (rkcs & (1 << 6)) {
+            bus.cpu.interrupt(INTRK, 5);
+        }
         break;
     default:
         printf("unimplemented RK05 operation %06o\n", ((rkcs & 017) >> 1));
@@ -98,16 +207,70 @@ void RK11::step() {
     }
 }
 
-void RK11::readwrite() {
-    if (rkwc == 0) {
-        rkready();
+// seektime returns the modelled time for the heads to move between
+// cylinders.
+uint64_t RK11::seektime(const uint32_t from, const uint32_t to) {
+    const uint32_t moved = std::max(from, to) - std::min(from, to);
+    return moved ? RKSETTLE + RKTRACK * moved : 0;
+}
+
+// seek sends the selected drive's heads to cylinder. The controller is
+// ready for another command at once, search complete is signalled when
+// the heads arrive, straight away unless seeks are modelled.
+void RK11::seek() {
+    auto &d = drives[drive];
+    auto &sched = bus.sched;
+    rkcs &= ~0x2000; // Clear search complete - set by seekdone
+    rkready();
+    if (rkcs & (1 << 6)) {
+        bus.cpu.interrupt(INTRK, 5);
+    }
+    // a seek issued while the heads are moving starts when they arrive.
+    const uint64_t start = std::max(sched.now, d.arrive);
+    d.arrive = start + (model ? seektime(d.head, cylinder) : 0);
+    d.head = cylinder;
+    d.seeking = true;
+    if (!model) {
+        seekdone();
+        return;
+    }
+    uint64_t first = UINT64_MAX;
+    for (const auto &o : drives) {
+        if (o.seeking) {
+            first = std::min(first, o.arrive);
+        }
+    }
+    sched.at(EVRKSEEK, first - sched.now);
+}
+
+void RK11::seekdone() {
+    auto &sched = bus.sched;
+    uint64_t first = UINT64_MAX;
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        auto &d = drives[i];
+        if (!d.seeking) {
+            continue;
+        }
+        if (d.arrive > sched.now) {
+            first = std::min(first, d.arrive);
+            continue;
+        }
+        d.seeking = false;
+        id = i;
+        rkcs |= 0x2000; // search complete
         if (rkcs & (1 << 6)) {
-            cpu.interrupt(INTRK, 5);
+            bus.cpu.interrupt(INTRK, 5);
         }
-        return;
     }
+    if (first != UINT64_MAX) {
+        sched.at(EVRKSEEK, first - sched.now);
+    }
+}
 
-    bool w = ((rkcs >> 1) & 7) == 1;
+// readwrite hands a transfer of rkwc words between the disk and core at
+// rkba to the I/O thread, the guest runs on while it is in flight.
+void RK11::readwrite() {
+    const bool w = ((rkcs >> 1) & 7) == 1;
     if (0) {
         printf("rk11: step: RKCS: %06o RKBA: %06o RKWC: %06o cylinder: %03o "
                "surface: %03o sector: %03o "
@@ -115,41 +278,112 @@ void RK11::readwrite() {
                rkcs, rkba, rkwc, cylinder, surface, sector, w, rker);
     }
 
-    for (auto i = 0; i < 256 && rkwc != 0; i++) {
-        if (w) {
-            auto val = cpu.unibus.read16(rkba);
-            uint8_t buf[2] = {static_cast<uint8_t>(val & 0xff),
-                              static_cast<uint8_t>(val >> 8)};
-            assert(fwrite(&buf, 1, 2, rkdata) == 2);
+    // rkwc holds the two's complement of the words to transfer, the
+    // transfer stops at the end of the disk.
+    const uint32_t pos = (cylinder * 24 + surface * 12 + sector) * 256;
+    uint32_t n = uint16_t(-rkwc);
+    if (n > (RKSIZE >> 1) - pos) {
+        n = (RKSIZE >> 1) - pos;
+        rker |= RKOVR;
+    }
+    auto &d = drives[drive];
+    if (w) {
+        d.pack.reserve((pos + n) << 1);
+    }
+
+    io = {w, uint8_t(drive), rkba, pos << 1, n, 0};
+    busy = true;
+    rkcs &= ~1; // GO is taken
+    if (model) {
+        auto &sched = bus.sched;
+        // a drive still seeking elsewhere finishes that first.
+        const uint64_t start = std::max(sched.now, d.arrive);
+        const uint64_t seek = start + seektime(d.head, cylinder);
+        // the sector under the heads once the seek has finished.
+        const uint32_t under = (seek / RKSECTOR) % 12;
+        const uint32_t rotate = ((sector + 12 - under) % 12) * RKSECTOR;
+        io.due = seek + rotate + (uint64_t(n) * RKSECTOR >> 8);
+        sched.at(EVRKIO, io.due - sched.now);
+    }
+    iothread.submit([this] { perform(io); });
+}
+
+// perform copies the words of t, it runs on the I/O thread.
+void RK11::perform(const transfer &t) {
+    auto &d = drives[t.drive];
+    // rkba wraps within the first 64k of core, so a transfer takes at most
+    // two runs of consecutive words.
+    uint16_t ba = t.ba;
+    for (auto off = t.off, left = t.n; left != 0;) {
+        const uint32_t len = std::min<uint32_t>(left, (0200000 - ba) >> 1);
+        auto *const p = &bus.core[ba >> 1];
+        if (t.w) {
+            d.pack.write(off, p, len);
         } else {
-            uint8_t buf[2];
-            assert(fread(&buf, 1, 2, rkdata) == 2);
-            cpu.unibus.write16(rkba, static_cast<uint16_t>(buf[0]) |
-                                         static_cast<uint16_t>(buf[1]) << 8);
-        }
-        rkba += 2;
-        rkwc++;
-    }
-    sector++;
-    if (sector > 013) {
-        sector = 0;
-        surface++;
-        if (surface > 1) {
-            surface = 0;
-            cylinder++;
-            if (cylinder > 0312) {
-                rker |= RKOVR;
-                return;
-            }
+            d.pack.read(off, p, len);
         }
+        ba += len << 1;
+        off += len << 1;
+        left -= len;
     }
 }
 
-void RK11::seek() {
-    const uint32_t pos = (cylinder * 24 + surface * 12 + sector) * 512;
-    if (fseek(rkdata, pos, SEEK_SET)) {
-        printf("rkstep: failed to seek\n");
-        std::abort();
+void RK11::complete() {
+    if (!busy) {
+        return;
+    }
+    auto &sched = bus.sched;
+    if (model) {
+        if (sched.now < io.due) {
+            // the host was quicker than the drive.
+            return;
+        }
+        iothread.drain();
+        iothread.finished();
+    } else if (!iothread.finished()) {
+        return;
+    }
+    busy = false;
+
+    auto &d = drives[io.drive];
+    if (io.w) {
+        const bool clean = d.pack.written(io.off, io.n << 1);
+        switch (policy) {
+        case SYNCWRITE:
+            d.pack.sync();
+            break;
+        case SYNCPERIODIC:
+            // the first write since the last sync starts the period.
+            if (clean) {
+                sched.at(EVSYNC, syncperiod);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    for (auto left = io.n; left != 0;) {
+        const uint32_t len = std::min<uint32_t>(left, (0200000 - rkba) >> 1);
+        if (!io.w) {
+            bus.cpu.invalidate(rkba, len << 1);
+        }
+        rkba += len << 1;
+        rkwc += len;
+        left -= len;
+    }
+
+    // leave the disk address at the sector following the transfer.
+    const auto next = ((io.off >> 1) + io.n + 255) >> 8;
+    cylinder = next / 24;
+    surface = (next / 12) & 1;
+    sector = next % 12;
+    rkda = (io.drive << 13) | (cylinder << 5) | (surface << 4) | sector;
+    d.head = std::min<uint32_t>(cylinder, 0312);
+    id = io.drive;
+
+    rkready();
+    if (rkcs & (1 << 6)) {
+        bus.cpu.interrupt(INTRK, 5);
     }
 }
 
@@ -159,7 +393,14 @@ void RK11::write16(const uint32_t a, const uint16_t v) {
     case 0777404:
         rkcs =
             (v & ~0xf080) | (rkcs & 0xf080); // Bits 7 and 12 - 15 are read only
-
+        if (rkcs & 01) {
+            if (busy) {
+                // the controller isn't ready for another command.
+                rkcs &= ~1;
+            } else {
+                bus.sched.at(EVRK, latency);
+            }
+        }
         break;
     case 0777406:
         rkwc = v;
@@ -182,7 +423,14 @@ void RK11::write16(const uint32_t a, const uint16_t v) {
 
 void RK11::reset() {
     printf("rk11: reset\n");
-    rkds = 04700; // Set bits 6, 7, 8, 11
+    // a transfer in flight finishes, but is never reported.
+    drain();
+    iothread.finished();
+    busy = false;
+    for (auto &d : drives) {
+        d.seeking = false;
+    }
+    id = 0;
     rker = 0;
     rkcs = 0200;
     rkwc = 0;
@@ -190,3 +438,40 @@ void RK11::reset() {
     rkda = 0;
     drive = cylinder = surface = sector = 0;
 }
+
+void RK11::snapshot(Snapshot &s) {
+    if (!s.restoring) {
+        // the transfer in flight reaches the pack and core first.
+        drain();
+        sync();
+    }
+    for (uint8_t i = 0; i < drives.size(); i++) {
+        auto &d = drives[i];
+        std::string path = d.pack.attached() ? d.pack.path : "";
+        s.string(path);
+        if (s.restoring && !path.empty() && !attach(i, path.c_str())) {
+            s.fail("can't attach " + path);
+        }
+        bool locked = d.pack.locked;
+        s.field(locked);
+        d.pack.locked |= locked;
+        s.field(d.head);
+        s.field(d.seeking);
+        s.field(d.arrive);
+    }
+    s.field(rker);
+    s.field(rkcs);
+    s.field(rkwc);
+    s.field(rkba);
+    s.field(rkda);
+    s.field(drive);
+    s.field(sector);
+    s.field(surface);
+    s.field(cylinder);
+    s.field(id);
+    s.field(io);
+    s.field(busy);
+    if (s.restoring && s.ok() && busy) {
+        iothread.submit([this] { perform(io); });
+    }
+}
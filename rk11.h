@@ -1,23 +1,117 @@
 #pragma once
+#include <array>
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
+
+#include "iothread.h"
+#include "pack.h"
+
+class Snapshot;
+class UNIBUS;
 
 class RK11 {
 
   public:
-    FILE *rkdata;
+    explicit RK11(UNIBUS &bus);
+
+    // latency is the number of instructions from setting GO to the
+    // command running.
+    uint32_t latency = 1;
+
+    // model delays the completion of each transfer by the time an RK05
+    // would take to seek to it, wait for the sector to come round and
+    // transfer it, counting an instruction as a microsecond. Transfers
+    // then complete at the same point however fast the host disk is.
+    // Otherwise a transfer completes as soon as the host has done it. Seeks
+    // take their modelled time too, a drive may seek while another
+    // transfers.
+    bool model = false;
+
+    syncpolicy policy = SYNCEXIT;
+    uint32_t syncperiod = 10000000;
+
+    // attach maps the disk image at path as drive. An image which can only
+    // be opened for reading is write locked. It returns false on failure.
+    bool attach(uint8_t drive, const char *path);
+
+    // complete finishes the transfer in flight once the I/O thread has
+    // performed it.
+    void complete();
+
+    // seekdone finishes the modelled seeks which are due.
+    void seekdone();
+
+    // sync flushes the written parts of the images to the host disk.
+    void sync();
+
+    // readahead sets how many cylinders past a run of sequential reads are
+    // brought in from the host disk ahead of the guest asking for them.
+    void readahead(uint32_t cylinders);
+
+    // report prints each drive's cache counters to stderr.
+    void report();
+
+    // drain waits for the transfer in flight, if any, to reach the pack
+    // and core.
+    void drain();
+
+    // forked must run in a clone after fork. Each pack becomes an overlay
+    // at prefix followed by rk and the drive number, so the clone's writes
+    // are its own. It returns false on failure.
+    bool forked(const std::string &prefix);
 
     uint16_t read16(uint32_t a);
     void write16(uint32_t a, uint16_t v);
     void reset();
     void step();
 
+    // snapshot carries the controller, its drives and the paths of their
+    // packs, which a restore attaches. A transfer in flight is performed
+    // again once restored.
+    void snapshot(Snapshot &s);
+
   private:
-    uint16_t rkds, rker, rkcs, rkwc, rkba, rkda;
+    UNIBUS &bus;
+    uint16_t rker, rkcs, rkwc, rkba, rkda;
     uint32_t drive, sector, surface, cylinder;
 
+    // id is the drive which last finished a command, reported in RKDS.
+    uint8_t id;
+
+    // An RK05 drive and the pack loaded in it.
+    struct rk05 {
+        Pack pack;
+
+        // head is the cylinder the heads were last sent to, while seeking
+        // they reach it at arrive.
+        uint32_t head = 0;
+        bool seeking = false;
+        uint64_t arrive = 0;
+    };
+
+    std::array<rk05, 8> drives;
+
+    // A transfer handed to the I/O thread, which copies n words between
+    // the drive's image at byte off and core at ba. The controller stays
+    // busy until complete has run.
+    struct transfer {
+        bool w;
+        uint8_t drive;
+        uint16_t ba;
+        uint32_t off, n;
+        uint64_t due; // when a modelled transfer completes
+    } io;
+    bool busy = false;
+    IOThread iothread;
+
+    void perform(const transfer &t);
+
     void rknotready();
     void rkready();
+    void rkerror(uint16_t e);
+    void go();
     void readwrite();
     void seek();
+    uint64_t seektime(uint32_t from, uint32_t to);
 };
@@ -0,0 +1,164 @@
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "kb11.h"
+#include "scheduler.h"
+
+Scheduler::Scheduler(UNIBUS &bus)
+    : now(0), bus(bus), next(never), pending(0), wake(-1), sleeping(false) {
+    deadline.fill(never);
+    create();
+}
+
+void Scheduler::create() {
+    wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake == -1) {
+        perror("eventfd");
+    }
+}
+
+void Scheduler::forked() {
+    close(wake);
+    wake = -1;
+    create();
+}
+
+void Scheduler::at(const enum event e, const uint32_t delay) {
+    deadline[e] = now + delay;
+    // only ever lower next, signal may zero it from another thread.
+    auto n = next.load(std::memory_order_relaxed);
+    while ((deadline[e] < n) &&
+           !next.compare_exchange_weak(n, deadline[e],
+                                       std::memory_order_relaxed)) {
+    }
+}
+
+void Scheduler::cancel(const enum event e) {
+    // next may now be early, which costs a run finding nothing due.
+    deadline[e] = never;
+}
+
+void Scheduler::signal(const enum event e) {
+    pending.fetch_or(1 << e);
+    next.store(0, std::memory_order_relaxed);
+    if (sleeping.load()) {
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto n = write(wake, &one, sizeof(one));
+    }
+}
+
+void Scheduler::run() {
+    auto due = pending.exchange(0);
+    for (uint8_t e = 0; e < NEVENTS; e++) {
+        if (deadline[e] <= now) {
+            deadline[e] = never;
+            due |= 1 << e;
+        }
+    }
+    for (uint8_t e = 0; e < NEVENTS; e++) {
+        if (due & (1 << e)) {
+            fire(static_cast<enum event>(e));
+        }
+    }
+    uint64_t n = never;
+    for (auto d : deadline) {
+        if (d < n) {
+            n = d;
+        }
+    }
+    next.store(n, std::memory_order_relaxed);
+    if (pending.load() || yielding) {
+        // signalled while running, come straight back. A yield stays due
+        // until the run loop has seen it, WAIT may have run the events.
+        next.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Scheduler::wait() {
+    if (due()) {
+        return;
+    }
+    const auto n = next.load(std::memory_order_relaxed);
+    if (n != never) {
+        now = n;
+        return;
+    }
+    // signal checks sleeping after setting pending, so an event signalled
+    // before the wait can't be missed.
+    sleeping.store(true);
+    if (!pending.load()) {
+        struct pollfd p = {wake, POLLIN, 0};
+        if (::poll(&p, 1, -1) > 0) {
+            // drain it, the event is already pending.
+            uint64_t n;
+            [[maybe_unused]] const auto r = read(wake, &n, sizeof(n));
+        }
+    }
+    sleeping.store(false);
+}
+
+void Scheduler::fire(const enum event e) {
+    switch (e) {
+    case EVRK:
+        bus.rk11.step();
+        break;
+    case EVRKIO:
+        bus.rk11.complete();
+        break;
+    case EVRKSEEK:
+        bus.rk11.seekdone();
+        break;
+    case EVRPIO:
+        bus.rh11.complete();
+        break;
+    case EVTTYIN:
+        bus.cons.poll();
+        break;
+    case EVTTYOUT:
+        bus.cons.xmit();
+        break;
+    case EVTTYWRITE:
+        bus.cons.written();
+        break;
+    case EVLP:
+        bus.lp11.poll();
+        break;
+    case EVCLOCK:
+        bus.kw11.tick();
+        break;
+    case EVSYNC:
+        bus.rk11.sync();
+        bus.rh11.sync();
+        break;
+    case EVSTATS:
+        bus.rk11.report();
+        bus.rh11.report();
+        break;
+    case EVYIELD:
+        yielding = true;
+        break;
+    case EVSNAP:
+    case EVCLONE:
+        if (host) {
+            host(e);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void Scheduler::snapshot(Snapshot &s) {
+    s.field(now);
+    s.field(deadline);
+    uint32_t p = pending.load();
+    s.field(p);
+    if (s.restoring) {
+        pending.store(p);
+        // run straight away, which works out the next deadline.
+        next.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+class Snapshot;
+class UNIBUS;
+
+// device events, run in this order when they fall due together.
+enum event {
+    EVRK,
+    EVRKIO,
+    EVRKSEEK,
+    EVRPIO,
+    EVTTYIN,
+    EVTTYOUT,
+    EVTTYWRITE,
+    EVLP,
+    EVCLOCK,
+    EVSYNC,
+    EVSTATS,
+    EVSNAP,
+    EVCLONE,
+    EVYIELD,
+    NEVENTS
+};
+
+// Scheduler runs device events at deadlines counted in executed
+// instructions, the cpu runs uninterrupted until the nearest one.
+class Scheduler {
+  public:
+    explicit Scheduler(UNIBUS &bus);
+
+    // now is the number of instructions executed.
+    uint64_t now;
+
+    // at runs e once delay more instructions have executed, replacing any
+    // deadline already pending for e.
+    void at(enum event e, uint32_t delay);
+
+    // signal runs e after the current instruction, it is safe to call from
+    // a signal handler or another thread, and wakes wait.
+    void signal(enum event e);
+
+    // cancel drops the deadline pending for e, if any.
+    void cancel(enum event e);
+
+    // yielding is set once EVYIELD has run, the machine's time slice is
+    // over and it should return to whatever is running it. Events stay due
+    // until it is cleared.
+    bool yielding = false;
+
+    // host runs EVSNAP and EVCLONE, which belong to whatever is running the
+    // machine rather than to the machine. They are ignored if it is unset.
+    std::function<void(enum event)> host;
+
+    // due reports whether an event should be run.
+    inline bool due() { return now >= next.load(std::memory_order_relaxed); }
+
+    // run runs the events which are due.
+    void run();
+
+    // wait idles until an event is due. A pending deadline is reached by
+    // skipping now forward to it, with none it sleeps until an event, such
+    // as console input or the clock, is signalled.
+    void wait();
+
+    // snapshot carries the time and the events pending.
+    void snapshot(Snapshot &s);
+
+    // forked must run in a clone after fork so that wait no longer shares
+    // the parent's wake.
+    void forked();
+
+  private:
+    static const uint64_t never = UINT64_MAX;
+
+    UNIBUS &bus;
+
+    std::array<uint64_t, NEVENTS> deadline;
+    std::atomic<uint64_t> next;
+    std::atomic<uint32_t> pending;
+
+    // wake is an eventfd signal writes to while wait is sleeping, so
+    // events signalled from other threads end the wait.
+    int wake;
+    std::atomic<bool> sleeping;
+
+    // create creates wake.
+    void create();
+    void fire(enum event e);
+};
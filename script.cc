@@ -0,0 +1,185 @@
+#include <chrono>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "machine.h"
+#include "match.h"
+#include "script.h"
+#include "words.h"
+
+// instructions run between checks on the time an expect has left.
+const uint32_t scriptslice = 1000000;
+
+enum steptype { EXPECT, SEND, TIMEOUT, EXIT };
+
+struct step {
+    steptype type;
+    std::string text;
+    uint32_t n;    // seconds or exit status
+    uint32_t line; // in the script, for reporting
+};
+
+static std::vector<step> steps;
+
+// at is the step being waited on, the script has ended once done is set.
+static size_t at = 0;
+static bool done = false;
+static int status = 0;
+
+// expected looks for the text expected in the console output.
+static Matcher expected;
+static uint32_t timeout = 0;
+static std::chrono::steady_clock::time_point deadline;
+
+// typed holds the input sent which the console's pipe hasn't taken yet,
+// feed is the pipe's write end.
+static std::string typed;
+static int feed = -1;
+
+bool loadscript(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == nullptr) {
+        perror(path);
+        return false;
+    }
+    char *line = nullptr;
+    size_t cap = 0;
+    bool ok = true;
+    for (uint32_t n = 1; ok && (getline(&line, &cap, f) != -1); n++) {
+        std::vector<std::string> w;
+        if (!words(line, w)) {
+            fprintf(stderr, "%s:%u: unterminated quote\n", path, n);
+            ok = false;
+            break;
+        }
+        if (w.empty() || (w[0][0] == '#')) {
+            continue;
+        }
+        if (w.size() != 2) {
+            fprintf(stderr, "%s:%u: want a step and its argument\n", path, n);
+            ok = false;
+            break;
+        }
+        step s = {EXPECT, w[1], 0, n};
+        if (w[0] == "expect") {
+            s.type = EXPECT;
+        } else if (w[0] == "send") {
+            s.type = SEND;
+        } else if (w[0] == "timeout") {
+            s.type = TIMEOUT;
+        } else if (w[0] == "exit") {
+            s.type = EXIT;
+        } else {
+            fprintf(stderr, "%s:%u: unknown step %s\n", path, n, w[0].c_str());
+            ok = false;
+            break;
+        }
+        s.n = strtoul(w[1].c_str(), nullptr, 0);
+        steps.push_back(s);
+    }
+    free(line);
+    fclose(f);
+    return ok;
+}
+
+// finish ends the script with status s.
+static void finish(Machine &m, const int s) {
+    done = true;
+    status = s;
+    m.stop();
+}
+
+// advance runs the steps from at up to the next expect, or the end of the
+// script, which waits for the guest to halt.
+static void advance(Machine &m) {
+    for (; at < steps.size(); at++) {
+        const auto &s = steps[at];
+        switch (s.type) {
+        case EXPECT:
+            expected = Matcher(s.text);
+            deadline = std::chrono::steady_clock::now() +
+                       std::chrono::seconds(timeout);
+            return;
+        case SEND:
+            typed += s.text;
+            break;
+        case TIMEOUT:
+            timeout = s.n;
+            break;
+        case EXIT:
+            finish(m, s.n);
+            return;
+        }
+    }
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+}
+
+// type hands the console as much of the input sent as its pipe will take.
+static void type(Machine &m) {
+    if (typed.empty()) {
+        return;
+    }
+    const auto n = write(feed, typed.data(), typed.size());
+    if (n > 0) {
+        typed.erase(0, n);
+        m.cpu.unibus.cons.rxready();
+    }
+}
+
+// scriptwatch follows m's console output c for the text expected.
+static void scriptwatch(Machine &m, const uint8_t c) {
+    if (done || (at == steps.size())) {
+        return;
+    }
+    if (!expected.feed(c)) {
+        return;
+    }
+    at++;
+    advance(m);
+    type(m);
+}
+
+void runscript(Machine &m) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        exit(1);
+    }
+    feed = fds[1];
+    if (fcntl(feed, F_SETFL, O_NONBLOCK) == -1) {
+        perror("fcntl(F_SETFL)");
+    }
+    auto &bus = m.cpu.unibus;
+    bus.cons.connect(fds[0], STDERR_FILENO);
+    bus.cons.watch = [&m](uint8_t c) { scriptwatch(m, c); };
+    advance(m);
+    type(m);
+    while (!done) {
+        if (m.run(scriptslice) == STOPHALT) {
+            printf("HALT: DR: %06o\n", m.cpu.display());
+            m.cpu.printstate();
+            status = m.cpu.display() & 0377;
+            break;
+        }
+        type(m);
+        if (!done && timeout &&
+            (std::chrono::steady_clock::now() > deadline)) {
+            if (at < steps.size()) {
+                fprintf(stderr, "script:%u: timed out expecting \"%s\"\n",
+                        steps[at].line, steps[at].text.c_str());
+            } else {
+                fprintf(stderr, "script: timed out waiting for a halt\n");
+            }
+            status = 1;
+            break;
+        }
+    }
+    m.flush();
+    fflush(stdout);
+    _exit(status);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+class Machine;
+
+// A script drives the console of a machine with no one at it. Each line
+// holds a step, run in turn, blank lines and those starting with # are
+// skipped:
+//
+//   expect text    wait until the console prints text
+//   send text      type text at the console
+//   timeout secs   fail each expect which follows, and the wait for a halt,
+//                  after secs seconds, or never if zero, the default
+//   exit status    stop, exiting with status
+//
+// Text may be double quoted, with \n, \r, \t, \" and \\ escapes. Input is
+// typed as fast as the guest reads it. Once the steps run out the guest
+// runs on until it halts. A halt ends the script, at any step, with the low
+// byte of the display register as its status. A timeout ends it with 1.
+
+// loadscript reads the script at path, returning false on failure.
+bool loadscript(const char *path);
+
+// runscript connects m's console to the script and runs m until the script
+// ends, then exits with its status.
+[[noreturn]] void runscript(Machine &m);
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <array>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "kb11.h"
+#include "snapshot.h"
+
+// A snapshot starts with the magic and the version of its layout, which
+// must change whenever the state carried does.
+static const char snapmagic[8] = {'P', 'D', 'P', '1', '1', 'S', 'N', 'P'};
+static const uint32_t snapversion = 4;
+
+enum {
+    SNAPBLOCK = 256, // words left out of a sparse field when all zero
+};
+
+void Snapshot::bytes(void *const p, const size_t n) {
+    if (!good) {
+        return;
+    }
+    if (restoring) {
+        good = fread(p, 1, n, f) == n;
+    } else {
+        good = fwrite(p, 1, n, f) == n;
+    }
+}
+
+void Snapshot::string(std::string &s) {
+    uint32_t n = s.size();
+    field(n);
+    if (restoring && good && (n > 4096)) {
+        fail("string too long");
+    }
+    if (restoring) {
+        s.resize(good ? n : 0);
+    }
+    bytes(s.data(), s.size());
+}
+
+void Snapshot::sparse(uint16_t *const p, const size_t n) {
+    // a bitmap of the blocks present, then the blocks.
+    std::vector<uint8_t> present((n / SNAPBLOCK + 7) >> 3);
+    if (!restoring) {
+        for (size_t i = 0; i < n; i += SNAPBLOCK) {
+            for (size_t j = i; j < std::min<size_t>(i + SNAPBLOCK, n); j++) {
+                if (p[j]) {
+                    present[i / SNAPBLOCK >> 3] |= 1 << (i / SNAPBLOCK & 7);
+                    break;
+                }
+            }
+        }
+    }
+    bytes(present.data(), present.size());
+    for (size_t i = 0; i < n; i += SNAPBLOCK) {
+        const size_t len = std::min<size_t>(SNAPBLOCK, n - i);
+        if (present[i / SNAPBLOCK >> 3] & (1 << (i / SNAPBLOCK & 7))) {
+            bytes(p + i, len << 1);
+        } else if (restoring) {
+            memset(p + i, 0, len << 1);
+        }
+    }
+}
+
+void Snapshot::fail(const std::string &why) {
+    if (good) {
+        fprintf(stderr, "snapshot: %s\n", why.c_str());
+    }
+    good = false;
+}
+
+// header carries the magic and version, a restore fails if either differs.
+static void header(Snapshot &s) {
+    std::array<char, 8> magic;
+    memcpy(magic.data(), snapmagic, sizeof(snapmagic));
+    uint32_t version = snapversion;
+    s.field(magic);
+    s.field(version);
+    if (memcmp(magic.data(), snapmagic, sizeof(snapmagic))) {
+        s.fail("not a snapshot");
+    } else if (version != snapversion) {
+        s.fail("snapshot version " + std::to_string(version) +
+               ", expected " + std::to_string(snapversion));
+    }
+}
+
+bool savesnapshot(KB11 &cpu, const char *path) {
+    // written aside and renamed into place, so path always holds a whole
+    // snapshot.
+    const std::string tmp = std::string(path) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        perror(tmp.c_str());
+        return false;
+    }
+    Snapshot s(f, false);
+    header(s);
+    cpu.snapshot(s);
+    if ((fclose(f) != 0) || !s.ok() || (rename(tmp.c_str(), path) != 0)) {
+        perror(path);
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool restoresnapshot(KB11 &cpu, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+        perror(path);
+        return false;
+    }
+    Snapshot s(f, true);
+    header(s);
+    cpu.snapshot(s);
+    fclose(f);
+    if (!s.ok()) {
+        fprintf(stderr, "%s: can't restore snapshot\n", path);
+    }
+    return s.ok();
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+
+// Snapshot carries the state of the machine to or from a snapshot file.
+// Each part of the machine passes its state through the same calls in the
+// same order whether saving or restoring, so the two can't drift apart.
+// Values are in host byte order, a snapshot is restored on the host which
+// took it.
+class Snapshot {
+  public:
+    Snapshot(FILE *f, bool restoring) : restoring(restoring), f(f) {}
+
+    // restoring is set when the fields are read from the file, rather than
+    // written to it.
+    const bool restoring;
+
+    template <typename T> inline void field(T &v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        bytes(&v, sizeof(v));
+    }
+
+    void bytes(void *p, size_t n);
+    void string(std::string &s);
+
+    // sparse carries the n words at p, leaving out the blocks of them which
+    // are zero.
+    void sparse(uint16_t *p, size_t n);
+
+    // fail marks the snapshot as unusable, printing why.
+    void fail(const std::string &why);
+    inline bool ok() const { return good; }
+
+  private:
+    FILE *const f;
+    bool good = true;
+};
+
+class KB11;
+
+// savesnapshot writes the state of cpu's machine to path, restoresnapshot
+// replaces the state of cpu's machine, reattaching its disk packs, with the
+// one saved there. They return false on failure.
+bool savesnapshot(KB11 &cpu, const char *path);
+bool restoresnapshot(KB11 &cpu, const char *path);
@@ -1,27 +1,80 @@
 #pragma once
 #include "kl11.h"
 #include "rk11.h"
+#include "rh11.h"
 #include "kw11.h"
 #include "pc11.h"
 #include "lp11.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include <cstdlib>
 #include <stdint.h>
+#include <stdio.h>
 
 const uint32_t IOBASE_18BIT = 0760000;
 
+class KB11;
+
 class UNIBUS {
+  public:
+    explicit UNIBUS(KB11 &cpu) : cpu(cpu) {}
+
+    // cpu is the processor the devices interrupt. It owns the bus.
+    KB11 &cpu;
+
+  private:
+
+    // iohandler calls the register accessors of the device claiming a word
+    // of the I/O page.
+    struct iohandler {
+        void *dev;
+        uint16_t (*read16)(void *dev, uint32_t a);
+        void (*write16)(void *dev, uint32_t a, uint16_t v);
+    };
+
+    // io holds the handler for each word of the I/O page, indexed by its
+    // offset from IOBASE_18BIT. It is declared ahead of the devices, which
+    // claim their registers as they are constructed.
+    std::array<iohandler, (((0777777 + 1) - IOBASE_18BIT) >> 1)> io{};
 
   public:
     std::array<uint16_t,(IOBASE_18BIT >> 1)> core;
 
-    KL11 cons;
-    RK11 rk11;
-    KW11 kw11;
-    PC11 ptr;
-    LP11 lp11;
+    // sched is declared ahead of the devices, which post events to it.
+    Scheduler sched{*this};
+
+    KL11 cons{*this};
+    RK11 rk11{*this};
+    RH11 rh11{*this};
+    KW11 kw11{*this};
+    PC11 ptr{*this};
+    LP11 lp11{*this};
+
+    // attach claims the I/O page addresses from lo up to, but not
+    // including, hi for dev. Accesses to them are passed to its read16 and
+    // write16, accesses to addresses no device has claimed are bus errors.
+    template <typename D> void attach(D &dev, uint32_t lo, uint32_t hi) {
+        for (auto a = lo; a < hi; a += 2) {
+            auto &h = io[(a - IOBASE_18BIT) >> 1];
+            if (h.dev) {
+                printf("unibus: %06o claimed twice\n", a);
+                std::abort();
+            }
+            h.dev = &dev;
+            h.read16 = [](void *d, uint32_t a) {
+                return static_cast<D *>(d)->read16(a);
+            };
+            h.write16 = [](void *d, uint32_t a, uint16_t v) {
+                static_cast<D *>(d)->write16(a, v);
+            };
+        }
+    }
 
     void write16(uint32_t a, uint16_t v);
     uint16_t read16(uint32_t a);
 
     void reset();
 
+    // snapshot carries core, the scheduler and the devices.
+    void snapshot(Snapshot &s);
 };
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include <string>
+#include <vector>
+
+#include "words.h"
+
+bool words(const std::string &line, std::vector<std::string> &w) {
+    std::string word;
+    bool in = false, quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"') {
+                quoted = false;
+                continue;
+            }
+            if ((c == '\\') && (i + 1 < line.size())) {
+                switch (c = line[++i]) {
+                case 'n':
+                    c = '\n';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                }
+            }
+            word += c;
+            continue;
+        }
+        if ((c == ' ') || (c == '\t') || (c == '\n')) {
+            if (in) {
+                w.push_back(word);
+                word.clear();
+                in = false;
+            }
+            continue;
+        }
+        in = true;
+        if (c == '"') {
+            quoted = true;
+            continue;
+        }
+        word += c;
+    }
+    if (in) {
+        w.push_back(word);
+    }
+    return !quoted;
+}
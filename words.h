@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// words appends the words of line, separated by blanks, to w. A word may be
+// double quoted, with \n, \r, \t, \" and \\ escapes, to hold blanks. It
+// returns false if a quote is left open.
+bool words(const std::string &line, std::vector<std::string> &w);